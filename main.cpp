@@ -1,33 +1,53 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
 #include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <list>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
 using namespace std;
 
 // Different types of membership functions that can be used
 // in fuzzy sets
 enum MFType
 {
-  TRIANG, // Triangular membership function type
-  TRAP,   // Trapezoidal membership function type
-  SAT,    // Saturation membership function type
-  GAUSS   // Gaussian membership function type
+  TRIANG,   // Triangular membership function type
+  TRAP,     // Trapezoidal membership function type
+  SAT,      // Saturation membership function type
+  GAUSS,    // Gaussian membership function type
+  SINGLETON // Singleton membership function type (a single point)
 };
 
 /******* Membership Functions *******/
+// The functions are templated on the scalar type T (double or float) so
+// the engines can be instantiated in single precision
 
 // Triangular membership function for a fuzzy set
 // 4 parameters, representing the left, center, and right boundaries of the triangle
 // X is the value for which the function will be evaluated
-double triangmf(double left, double center, double right, double x)
+template <class T>
+T triangmf(T left, T center, T right, T x)
 {
 
   // Initialize the variable that will store the result of the calculation
-  double res = 0;
+  T res = 0;
 
   // If x is less than or equal to the left value, it does not belong to the set
   if (x <= left)
@@ -44,7 +64,7 @@ double triangmf(double left, double center, double right, double x)
   // If x is within the range of the center and the right value, calculate the
   // membership degree with the descending slope formula.
   else if (x < right && x > center)
-    res = 1 - abs((right - x) / (center - right));
+    res = 1 - abs((center - x) / (right - center));
 
   return res; // Return the calculated membership degree
 }
@@ -52,11 +72,11 @@ double triangmf(double left, double center, double right, double x)
 // Trapezoidal membership function
 // 5 parameters, representing the lower left, upper left, upper right, and lower right boundaries of the trapezoid
 // x is the value for which the membership function will be evaluated
-double trapmf(double lowLeft, double upLeft, double upRight, double lowRight,
-              double x)
+template <class T>
+T trapmf(T lowLeft, T upLeft, T upRight, T lowRight, T x)
 {
   // Initialize the variable that will store the result of the calculation
-  double res = 0;
+  T res = 0;
 
   // If x is less than or equal to the lower left value, it does not belong to the set
   if (x <= lowLeft)
@@ -84,11 +104,12 @@ double trapmf(double lowLeft, double upLeft, double upRight, double lowRight,
 // Saturation membership function for a fuzzy set
 // 3 parameters, representing the upper and lower limits
 // x is the value for which the membership function will be evaluated
-double satmf(double up, double down, double x)
+template <class T>
+T satmf(T up, T down, T x)
 {
 
   // Initialize the variable that will store the result of the calculation
-  double res = 0;
+  T res = 0;
 
   // Check if the region is to the left or right
   if (up < down)
@@ -123,7 +144,8 @@ double satmf(double up, double down, double x)
 // Gaussian membership function
 // 3 parameters, representing the center of the function and the width of the bell curve
 // x is the value for which the membership function will be evaluated
-double gaussianmf(double center, double width, double x)
+template <class T>
+T gaussianmf(T center, T width, T x)
 {
 
   // Calculate the membership degree using the Gaussian function and return the result
@@ -135,26 +157,204 @@ double gaussianmf(double center, double width, double x)
       -pow((x - center) / (sqrt(2 * width)), 2));
 }
 
-/******* Norms *******/
-// Implement the AND operation in vector form
-// Takes a vector of fuzzy arguments represented as membership values
-// Returns the result of the AND operation
-double fAnd(vector<double> &args)
+// Singleton membership function for a fuzzy set
+// 1 parameter, the only point that belongs to the set
+// x is the value for which the membership function will be evaluated
+template <class T>
+T singletonmf(T position, T x)
+{
+  // The membership degree is 1 at the position and 0 everywhere else
+  return x == position ? 1 : 0;
+}
+
+// Function to evaluate a membership function on any scalar type
+// Depending on the type of membership function, the corresponding function is called
+// To calculate the membership degree; wrong parameter counts give 0
+template <class T>
+T membership(MFType type, const vector<T> &params, T x)
+{
+  T res = 0;
+
+  switch (type)
+  {
+  case TRIANG:
+    if (params.size() == 3)
+      res = triangmf(params[0], params[1], params[2], x);
+    break;
+  case TRAP:
+    if (params.size() == 4)
+      res = trapmf(params[0], params[1], params[2], params[3], x);
+    break;
+  case SAT:
+    if (params.size() == 2)
+      res = satmf(params[0], params[1], x);
+    break;
+  case GAUSS:
+    if (params.size() == 2)
+      res = gaussianmf(params[0], params[1], x);
+    break;
+  case SINGLETON:
+    if (params.size() == 1)
+      res = singletonmf(params[0], x);
+    break;
+  default:
+    cout << "No adequate MF" << endl;
+    break;
+  }
+
+  return res; // Return the calculated membership degree
+}
+
+// GCC 12 reports false maybe-uninitialized warnings on the undefined
+// pass-through operand of the AVX-512 intrinsics. Every SIMD kernel uses
+// them through the lane traits below, so the warning is silenced once here
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+struct BFloat16;
+
+// Structure with the vector operations on lanes of Scalar used by the
+// engines templated on the scalar type. A float vector holds twice as many
+// lanes as a double vector of the same width. Storage types are widened to
+// Scalar when loaded
+template <class Scalar>
+struct Lanes;
+
+#if defined(__AVX512F__)
+template <>
+struct Lanes<double>
+{
+  typedef __m512d Vector;
+  static const size_t WIDTH = 8;
+  static Vector load(const double *p) { return _mm512_loadu_pd(p); }
+  static void store(double *p, Vector v) { _mm512_storeu_pd(p, v); }
+  static Vector min(Vector a, Vector b) { return _mm512_min_pd(a, b); }
+  static Vector max(Vector a, Vector b) { return _mm512_max_pd(a, b); }
+  static Vector add(Vector a, Vector b) { return _mm512_add_pd(a, b); }
+  static Vector mul(Vector a, Vector b) { return _mm512_mul_pd(a, b); }
+  static Vector zero() { return _mm512_setzero_pd(); }
+  static Vector set1(double x) { return _mm512_set1_pd(x); }
+};
+
+template <>
+struct Lanes<float>
+{
+  typedef __m512 Vector;
+  static const size_t WIDTH = 16;
+  static Vector load(const float *p) { return _mm512_loadu_ps(p); }
+  static Vector load(const BFloat16 *p)
+  {
+    __m512i words = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *)p));
+    return _mm512_castsi512_ps(_mm512_slli_epi32(words, 16));
+  }
+  static void store(float *p, Vector v) { _mm512_storeu_ps(p, v); }
+  static Vector min(Vector a, Vector b) { return _mm512_min_ps(a, b); }
+  static Vector max(Vector a, Vector b) { return _mm512_max_ps(a, b); }
+  static Vector add(Vector a, Vector b) { return _mm512_add_ps(a, b); }
+  static Vector mul(Vector a, Vector b) { return _mm512_mul_ps(a, b); }
+  static Vector zero() { return _mm512_setzero_ps(); }
+  static Vector set1(float x) { return _mm512_set1_ps(x); }
+};
+#elif defined(__AVX2__)
+template <>
+struct Lanes<double>
+{
+  typedef __m256d Vector;
+  static const size_t WIDTH = 4;
+  static Vector load(const double *p) { return _mm256_loadu_pd(p); }
+  static void store(double *p, Vector v) { _mm256_storeu_pd(p, v); }
+  static Vector min(Vector a, Vector b) { return _mm256_min_pd(a, b); }
+  static Vector max(Vector a, Vector b) { return _mm256_max_pd(a, b); }
+  static Vector add(Vector a, Vector b) { return _mm256_add_pd(a, b); }
+  static Vector mul(Vector a, Vector b) { return _mm256_mul_pd(a, b); }
+  static Vector zero() { return _mm256_setzero_pd(); }
+  static Vector set1(double x) { return _mm256_set1_pd(x); }
+};
+
+template <>
+struct Lanes<float>
 {
+  typedef __m256 Vector;
+  static const size_t WIDTH = 8;
+  static Vector load(const float *p) { return _mm256_loadu_ps(p); }
+  static Vector load(const BFloat16 *p)
+  {
+    __m256i words = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)p));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(words, 16));
+  }
+  static void store(float *p, Vector v) { _mm256_storeu_ps(p, v); }
+  static Vector min(Vector a, Vector b) { return _mm256_min_ps(a, b); }
+  static Vector max(Vector a, Vector b) { return _mm256_max_ps(a, b); }
+  static Vector add(Vector a, Vector b) { return _mm256_add_ps(a, b); }
+  static Vector mul(Vector a, Vector b) { return _mm256_mul_ps(a, b); }
+  static Vector zero() { return _mm256_setzero_ps(); }
+  static Vector set1(float x) { return _mm256_set1_ps(x); }
+};
+#endif
+#pragma GCC diagnostic pop
+
+// Vector type used by the SIMD reductions and kernels when the compiler targets AVX-512 or
+// AVX2 (e.g. with -march=native); other targets use plain lane loops
+#if defined(__AVX512F__) || defined(__AVX2__)
+typedef Lanes<double>::Vector LaneVector;
+const size_t LANE_WIDTH = Lanes<double>::WIDTH;
+#define LANE_LOAD Lanes<double>::load
+#define LANE_STORE Lanes<double>::store
+#define LANE_MIN Lanes<double>::min
+#define LANE_MAX Lanes<double>::max
+#define LANE_ADD Lanes<double>::add
+#define LANE_MUL Lanes<double>::mul
+#define LANE_ZERO Lanes<double>::zero
+#define LANE_SET1 Lanes<double>::set1
+#endif
 
-  // Initialize the variable with the first value of the vector
-  int minimum = args.front();
+/******* Norms *******/
+// Implement the AND operation over a span of fuzzy arguments
+// Takes a pointer to the membership values and their count
+// Returns the minimum, or 1 (the identity of AND) for an empty span
+// Uses four vector accumulators when SIMD is available so long spans are
+// limited by memory bandwidth rather than by the latency of min
+double fAnd(const double *args, size_t count)
+{
+  // Initialize the variable with the identity of the AND operation
+  double minimum = 1;
+  size_t i = 0;
 
-  // Iterate over all elements of the vector
-  for (int i = 0; i < args.size(); i++)
+#ifdef LANE_LOAD
+  if (count >= 4 * LANE_WIDTH)
   {
-    // Compare the current vector value with the minimum found
-    // If it's smaller, update the minimum value
-    if (minimum > args[i])
-      minimum = args[i];
+    LaneVector m0 = LANE_LOAD(args), m1 = LANE_LOAD(args + LANE_WIDTH),
+               m2 = LANE_LOAD(args + 2 * LANE_WIDTH),
+               m3 = LANE_LOAD(args + 3 * LANE_WIDTH);
+    for (i = 4 * LANE_WIDTH; i + 4 * LANE_WIDTH <= count; i += 4 * LANE_WIDTH)
+    {
+      m0 = LANE_MIN(m0, LANE_LOAD(args + i));
+      m1 = LANE_MIN(m1, LANE_LOAD(args + i + LANE_WIDTH));
+      m2 = LANE_MIN(m2, LANE_LOAD(args + i + 2 * LANE_WIDTH));
+      m3 = LANE_MIN(m3, LANE_LOAD(args + i + 3 * LANE_WIDTH));
+    }
+
+    // Horizontal minimum of the accumulators
+    double lanes[LANE_WIDTH];
+    LANE_STORE(lanes, LANE_MIN(LANE_MIN(m0, m1), LANE_MIN(m2, m3)));
+    for (size_t l = 0; l < LANE_WIDTH; l++)
+      minimum = min(minimum, lanes[l]);
   }
+#endif
+
+  // Remaining values, or all of them without SIMD
+  for (; i < count; i++)
+    minimum = min(minimum, args[i]);
 
-  return minimum; // Return the minimum value found in the vector
+  return minimum; // Return the minimum value found in the span
+}
+
+// Implement the AND operation in vector form
+// Takes a vector of fuzzy arguments represented as membership values
+// Returns the result of the AND operation
+double fAnd(const vector<double> &args)
+{
+  return fAnd(args.data(), args.size());
 }
 
 // Implement the AND operation for two fuzzy arguments
@@ -165,24 +365,49 @@ double fAnd(double a, double b)
   return min(a, b); // Return the result of the AND operation
 }
 
-// Implement the OR operation in vector form
-// Takes a vector of fuzzy arguments represented as membership values
-double fOr(const vector<double> &args)
+// Implement the OR operation over a span of fuzzy arguments
+// Takes a pointer to the membership values and their count
+// Returns the maximum, or 0 (the identity of OR) for an empty span
+double fOr(const double *args, size_t count)
 {
+  // Initialize the variable with the identity of the OR operation
+  double maximum = 0;
+  size_t i = 0;
 
-  // Initialize the variable with the first value of the vector
-  double maximum = args.front();
-
-  // Iterate over all elements of the vector
-  for (size_t i = 1; i < args.size(); ++i)
+#ifdef LANE_LOAD
+  if (count >= 4 * LANE_WIDTH)
   {
-    // Compare the current vector value with the maximum found
-    // If the current value is greater, update the maximum value
-    if (maximum < args[i])
-      maximum = args[i];
+    LaneVector m0 = LANE_LOAD(args), m1 = LANE_LOAD(args + LANE_WIDTH),
+               m2 = LANE_LOAD(args + 2 * LANE_WIDTH),
+               m3 = LANE_LOAD(args + 3 * LANE_WIDTH);
+    for (i = 4 * LANE_WIDTH; i + 4 * LANE_WIDTH <= count; i += 4 * LANE_WIDTH)
+    {
+      m0 = LANE_MAX(m0, LANE_LOAD(args + i));
+      m1 = LANE_MAX(m1, LANE_LOAD(args + i + LANE_WIDTH));
+      m2 = LANE_MAX(m2, LANE_LOAD(args + i + 2 * LANE_WIDTH));
+      m3 = LANE_MAX(m3, LANE_LOAD(args + i + 3 * LANE_WIDTH));
+    }
+
+    // Horizontal maximum of the accumulators
+    double lanes[LANE_WIDTH];
+    LANE_STORE(lanes, LANE_MAX(LANE_MAX(m0, m1), LANE_MAX(m2, m3)));
+    for (size_t l = 0; l < LANE_WIDTH; l++)
+      maximum = max(maximum, lanes[l]);
   }
+#endif
+
+  // Remaining values, or all of them without SIMD
+  for (; i < count; i++)
+    maximum = max(maximum, args[i]);
+
+  return maximum; // Return the maximum value found in the span
+}
 
-  return maximum; // Return the maximum value found
+// Implement the OR operation in vector form
+// Takes a vector of fuzzy arguments represented as membership values
+double fOr(const vector<double> &args)
+{
+  return fOr(args.data(), args.size());
 }
 
 // Implement the OR operation for two fuzzy arguments
@@ -194,6 +419,121 @@ double fOr(double a, double b)
   return max(a, b); // Return the maximum between a and b
 }
 
+/******* Reproducible Reductions *******/
+// Different ways of computing the floating-point sums of the engines
+// Every defuzzifier and engine takes its own mode, FAST_REDUCTION by default
+enum ReductionMode
+{
+  FAST_REDUCTION,         // Sums in the fastest order for the target
+  DETERMINISTIC_REDUCTION // Fixed partition and tree, bit-identical results
+};
+
+// The functions below are compiled without contracting a * b + c into a
+// fused multiply-add, which only some targets have, so their results do not
+// depend on the instruction set
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off")
+
+// Number of partial sums inside a block of a reproducible reduction
+const size_t REDUCTION_LANES = 8;
+
+// Number of values in every block of a reproducible reduction
+// Blocks can be reduced by different threads and lanes without changing
+// the result, since the partition does not depend on either
+const size_t REDUCTION_BLOCK = 256;
+
+// Function to reduce one block of at most REDUCTION_BLOCK values
+// Value i goes to partial sum i % REDUCTION_LANES, and the partial sums are
+// added with a fixed tree. The vector lanes hold the same partial sums as
+// the scalar loop, so every target gives the same bits
+// Adds a[i] * b[i] if Products is true, a[i] otherwise
+template <bool Products>
+double reproducibleBlock(const double *a, const double *b, size_t count)
+{
+  double partial[REDUCTION_LANES] = {0};
+  size_t i = 0;
+
+#ifdef LANE_LOAD
+  const size_t vectors = REDUCTION_LANES / LANE_WIDTH;
+  LaneVector sums[REDUCTION_LANES / LANE_WIDTH];
+  for (size_t v = 0; v < vectors; v++)
+    sums[v] = LANE_ZERO();
+  for (; i + REDUCTION_LANES <= count; i += REDUCTION_LANES)
+    for (size_t v = 0; v < vectors; v++)
+    {
+      LaneVector value = LANE_LOAD(a + i + v * LANE_WIDTH);
+      if (Products)
+        value = LANE_MUL(value, LANE_LOAD(b + i + v * LANE_WIDTH));
+      sums[v] = LANE_ADD(sums[v], value);
+    }
+  for (size_t v = 0; v < vectors; v++)
+    LANE_STORE(partial + v * LANE_WIDTH, sums[v]);
+#else
+  for (; i + REDUCTION_LANES <= count; i += REDUCTION_LANES)
+    for (size_t l = 0; l < REDUCTION_LANES; l++)
+      partial[l] += Products ? a[i + l] * b[i + l] : a[i + l];
+#endif
+
+  // Remaining values of the block
+  for (size_t l = 0; i < count; i++, l++)
+    partial[l] += Products ? a[i] * b[i] : a[i];
+
+  // Fixed tree: ((p0 + p1) + (p2 + p3)) + ((p4 + p5) + (p6 + p7))
+  for (size_t width = REDUCTION_LANES; width > 1; width /= 2)
+    for (size_t l = 0; l < width / 2; l++)
+      partial[l] = partial[2 * l] + partial[2 * l + 1];
+  return partial[0];
+}
+
+// Function to reduce a span with a fixed partition in blocks and a fixed
+// pairwise tree over the block sums
+template <bool Products>
+double reproducibleReduce(const double *a, const double *b, size_t count)
+{
+  // Block sums stay on the stack for spans of up to 64 blocks
+  size_t blockCount = (count + REDUCTION_BLOCK - 1) / REDUCTION_BLOCK;
+  double local[64];
+  vector<double> heap(blockCount > 64 ? blockCount : 0);
+  double *blocks = blockCount > 64 ? heap.data() : local;
+  if (blockCount == 0)
+    return 0;
+
+  for (size_t k = 0; k < blockCount; k++)
+  {
+    size_t i = k * REDUCTION_BLOCK;
+    blocks[k] = reproducibleBlock<Products>(a + i, b + i, min(REDUCTION_BLOCK, count - i));
+  }
+
+  // Pairwise tree: an odd block is carried to the next level unchanged
+  for (size_t width = blockCount; width > 1; width = (width + 1) / 2)
+    for (size_t j = 0; j < width / 2 + width % 2; j++)
+      blocks[j] = 2 * j + 1 < width ? blocks[2 * j] + blocks[2 * j + 1] : blocks[2 * j];
+  return blocks[0];
+}
+
+// Function to add the values of a span reproducibly
+// The result is bit-identical on every target and for every split of the
+// span in blocks
+double reproducibleSum(const double *values, size_t count)
+{
+  return reproducibleReduce<false>(values, values, count);
+}
+
+// Function to compute the dot product of two spans reproducibly
+double reproducibleDot(const double *a, const double *b, size_t count)
+{
+  return reproducibleReduce<true>(a, b, count);
+}
+
+// Function to get the point of sample i of a grid starting at lo
+// Used to build the sampling grids, so they are the same on every target
+double samplePoint(double lo, double step, int i)
+{
+  return lo + i * step;
+}
+
+#pragma GCC pop_options
+
 // Class to represent a fuzzy set
 class FuzzySet
 {
@@ -201,6 +541,8 @@ protected:
   string name;           // Name of the fuzzy set
   MFType type;           // Type of membership function
   vector<double> params; // Stores the parameters of the membership function
+  int variable = -1;     // Index of its declared linguistic variable (-1 none)
+  string variableName;   // Name of its declared linguistic variable
 
 public:
   FuzzySet(string n)
@@ -215,12 +557,121 @@ public:
   // Method to get the name of the fuzzy set
   string getName() const { return name; }
 
+  // Method to set the declared linguistic variable of the fuzzy set
+  // index is the position of the variable among the inputs or the outputs
+  void setVariable(int index, const string &n)
+  {
+    variable = index;
+    variableName = n;
+  }
+
+  // Method to get the index of the declared linguistic variable
+  // Returns -1 if the set was not declared under a variable
+  int getVariable() const { return variable; }
+
+  // Method to get the name of the declared linguistic variable
+  const string &getVariableName() const { return variableName; }
+
+  // Method to get the type of membership function
+  MFType getType() const { return type; }
+
   // Method to set the type of membership function and its parameters
   void setMF(MFType t, vector<double> &args)
   {
     type = t;
     params = args;
   }
+
+  // Method to get the interval outside of which the membership degree is 0
+  // Unbounded sides (saturation, Gaussian) are returned as -HUGE_VAL or HUGE_VAL
+  void getSupport(double &lo, double &hi) const
+  {
+    lo = -HUGE_VAL;
+    hi = HUGE_VAL;
+    if ((type == TRIANG && params.size() == 3) || (type == TRAP && params.size() == 4) ||
+        (type == SINGLETON && params.size() == 1))
+    {
+      lo = params.front();
+      hi = params.back();
+    }
+    else if (type == SAT && params.size() == 2)
+    {
+      if (params[0] < params[1])
+        hi = params[1]; // Saturated on the left
+      else
+        lo = params[1]; // Saturated on the right
+    }
+  }
+
+  // Method to know if the set is a singleton
+  bool isSingleton() const { return type == SINGLETON && params.size() == 1; }
+
+  // Method to get the position of a singleton set
+  double getPosition() const { return params[0]; }
+
+  // Method to add to points the breakpoints of the membership function
+  // (limits of its linear pieces, Gaussian center or singleton position)
+  // Between two breakpoints the function is smooth
+  void getBreakpoints(vector<double> &points) const
+  {
+    if (type == GAUSS && params.size() == 2)
+      points.push_back(params[0]);
+    else
+      points.insert(points.end(), params.begin(), params.end());
+  }
+
+  // Method to add to points the values of x where the membership degree
+  // crosses level, which are the corners added by clipping the set at level
+  void getLevelCrossings(double level, vector<double> &points) const
+  {
+    if (level <= 0 || level >= 1)
+      return;
+    if (type == TRIANG && params.size() == 3)
+    {
+      points.push_back(params[0] + level * (params[1] - params[0]));
+      points.push_back(params[2] - level * (params[2] - params[1]));
+    }
+    else if (type == TRAP && params.size() == 4)
+    {
+      points.push_back(params[0] + level * (params[1] - params[0]));
+      points.push_back(params[3] - level * (params[3] - params[2]));
+    }
+    else if (type == SAT && params.size() == 2)
+      points.push_back(params[0] + (1 - level) * (params[1] - params[0]));
+    else if (type == GAUSS && params.size() == 2)
+    {
+      double offset = sqrt(-2 * params[1] * log(level));
+      points.push_back(params[0] - offset);
+      points.push_back(params[0] + offset);
+    }
+  }
+
+  // Method to get the interval that covers the shape of the function
+  // Saturations cover both of their limits and Gaussians 5 widths around
+  // the center. Used to build the universe of discourse of the outputs
+  void getRange(double &lo, double &hi) const
+  {
+    lo = HUGE_VAL;
+    hi = -HUGE_VAL;
+    if (type == GAUSS && params.size() == 2)
+    {
+      lo = params[0] - 5 * sqrt(params[1]);
+      hi = params[0] + 5 * sqrt(params[1]);
+      return;
+    }
+    for (double p : params)
+    {
+      lo = min(lo, p);
+      hi = max(hi, p);
+    }
+  }
+
+protected:
+  // Method to evaluate the membership function of the set at x
+  double evalMF(double x) const
+  {
+    return membership(type, params, x); // Return the calculated membership degree
+  }
 };
 
 // Class representing an input fuzzy set
@@ -252,42 +703,17 @@ public:
       return "Saturation";
     case GAUSS:
       return "Gaussian";
+    case SINGLETON:
+      return "Singleton";
     default:
       return "Unknown";
     }
   }
 
   // Method to evaluate the membership degree of an input value x
-  // Depending on the type of membership function, the corresponding function is called
-  // To calculate the membership degree
   double eval(double x) const override
   {
-    double res = 0;
-
-    switch (type)
-    {
-    case TRIANG:
-      if (params.size() == 3)
-        res = triangmf(params[0], params[1], params[2], x);
-      break;
-    case TRAP:
-      if (params.size() == 4)
-        res = trapmf(params[0], params[1], params[2], params[3], x);
-      break;
-    case SAT:
-      if (params.size() == 2)
-        res = satmf(params[0], params[1], x);
-      break;
-    case GAUSS:
-      if (params.size() == 2)
-        res = gaussianmf(params[0], params[1], x);
-      break;
-    default:
-      cout << "No adequate MF" << endl;
-      break;
-    }
-
-    return res; // Return the calculated membership degree
+    return evalMF(x); // Return the calculated membership degree
   }
 
   // Method to get the calculated membership values
@@ -328,6 +754,8 @@ public:
       return "Saturation";
     case GAUSS:
       return "Gaussian";
+    case SINGLETON:
+      return "Singleton";
     default:
       return "Unknown";
     }
@@ -336,173 +764,4809 @@ public:
   // Method to evaluate the membership degree of an input value x
   double eval(double x) const override
   {
-    // Implement if necessary
-    return 0.0;
+    return evalMF(x); // Return the calculated membership degree
   }
 };
 
-// Class to handle fuzzy rules
-class Rules
+/******* Rule Parsing *******/
+// Connectives that can join two antecedents of a rule
+enum RuleOp
 {
-private:
-  vector<string> rules; // Vector to store the rules
+  AND_OP, // Conjunction, evaluated with fAnd
+  OR_OP   // Disjunction, evaluated with fOr
+};
 
-public:
-  // Method to add a rule to the rule set
-  void addRule(string r)
+// Split a rule of the form "IF A AND B ... THEN C" into its parts
+// terms receives the antecedent fuzzy set names, ops the connectives between
+// them (ops[i] joins terms[i] and terms[i + 1]) and consequent the output set
+// Returns false if the line is not a well formed flat rule
+bool parseRule(const string &line, vector<string> &terms, vector<RuleOp> &ops,
+               string &consequent)
+{
+  istringstream iss(line);
+  string word;
+
+  terms.clear();
+  ops.clear();
+  consequent = "";
+
+  // Every rule starts with the IF keyword
+  if (!(iss >> word) || (word != "IF" && word != "if"))
+    return false;
+
+  // Read antecedents and connectives until THEN is found
+  bool expectTerm = true;
+  while (iss >> word)
   {
-    // No validation of rule existence is performed
-    rules.push_back(r);
+    if (word == "THEN" || word == "then")
+      break;
+
+    // Parenthesized rules are only supported by the antecedent DAG
+    if (word.find_first_of("()") != string::npos)
+      return false;
+
+    if (expectTerm)
+      terms.push_back(word);
+    else if (word == "AND" || word == "and")
+      ops.push_back(AND_OP);
+    else if (word == "OR" || word == "or")
+      ops.push_back(OR_OP);
+    else
+      return false; // Two terms without a connective between them
+
+    expectTerm = !expectTerm;
   }
 
-  // Method to print the stored rules
-  void printRules() const
+  // The consequent is the single word after THEN
+  if (!(iss >> consequent))
+    return false;
+
+  return !terms.empty() && ops.size() + 1 == terms.size();
+}
+
+// Function to split a rule with several consequents joined by AND
+// ("IF A AND B THEN C AND D") into one rule per consequent
+// Returns the line unchanged if it has a single consequent, and an empty
+// vector if the consequents are joined by anything but AND (e.g. OR) or a
+// connective is missing its consequent
+vector<string> splitConsequents(const string &line)
+{
+  istringstream iss(line);
+  string word, antecedent;
+  vector<string> consequents;
+  bool afterThen = false;
+  bool expectConsequent = true; // Consequents and ANDs alternate after THEN
+
+  while (iss >> word)
   {
-    std::cout << "\nRead Rules: " << endl;
-    for (const auto &rule : rules)
+    if (afterThen)
     {
-      std::cout << rule << std::endl;
+      if (expectConsequent)
+        consequents.push_back(word);
+      else if (word != "AND" && word != "and")
+        return vector<string>();
+      expectConsequent = !expectConsequent;
+      continue;
     }
+    antecedent += (antecedent.empty() ? "" : " ") + word;
+    afterThen = word == "THEN" || word == "then";
   }
 
-  // Method to perform Mamdani inference
-  // Takes a map containing the input membership values as an argument
-  // Returns a map containing the output membership values
-  // Maximum membership is used
-  map<string, double> inferMamdani(map<string, double> inputMembershipValues)
-  {
-    multimap<string, double> outputMembershipValues;
+  if (afterThen && expectConsequent && !consequents.empty())
+    return vector<string>(); // Trailing AND
 
-    // Iterate over all stored rules
-    for (int i = 0, j = 3; i < rules.size(); i++)
-    {
-      j = 3;
-      string rule = rules[i];
-      string fuzzySetName = "";
+  if (consequents.size() <= 1)
+    return vector<string>(1, line);
 
-      cout << "IF" << endl;
+  vector<string> rules;
+  for (const auto &consequent : consequents)
+    rules.push_back(antecedent + " " + consequent);
+  return rules;
+}
 
-      bool andFlag = false, orFlag = false;
-      double accum = 0;
+/******* Compact Rule Storage *******/
+// Class to store rules in a compact bit-packed encoding
+// Term and output names are kept once in dictionaries. Every rule writes a
+// fixed-width header to one bit stream and its body to another, least
+// significant bit first:
+//   header : hasOr (1 bit, set if the rule uses OR), then the number of
+//            antecedents - 1 in arityBits
+//   body   : one bit per connective (1 = OR), only present if hasOr is set,
+//            the dictionary index of every antecedent in termBits each and
+//            the index of the consequent output set in outputBits
+// The widths are shared by the whole store and are the smallest that fit
+// the dictionaries and the longest rule; a rule that needs more bits
+// repacks the store once with the new widths, so 3000 terms cost 12 bits
+// per antecedent. Headers sit at fixed positions, so the evaluator finds
+// the next body without waiting on the current rule. Fields are read with
+// one unaligned 64-bit load (little endian, like the targets of the SIMD
+// kernels), and both streams keep 8 bytes of padding so loads stay inside
+class CompactRuleStore
+{
+private:
+  vector<unsigned char> headers;     // Header of every rule, then padding
+  vector<unsigned char> bodies;      // Body of every rule, then padding
+  size_t bodyBits = 0;               // Bits used by the bodies
+  int arityBits = 0;                 // Width of the arity field
+  int termBits = 0;                  // Width of a term index
+  int outputBits = 0;                // Width of an output index
+  vector<string> termNames;          // Dictionary of antecedent fuzzy sets
+  map<string, unsigned> termIndex;   // Index of each antecedent name
+  vector<string> outputNames;        // Dictionary of output fuzzy sets
+  map<string, unsigned> outputIndex; // Index of each output name
+  size_t ruleCount = 0;              // Number of encoded rules
 
-      // Analyze the rule to evaluate fuzzy inference
-      while (fuzzySetName != "THEN" && fuzzySetName != "then")
-      {
-        fuzzySetName = "";
-        while (rule[j] != ' ')
-        {
-          fuzzySetName += rule[j++];
-        }
+  // Helper to get the number of bits needed to write a value
+  static int bitsFor(size_t value)
+  {
+    int bits = 0;
+    while (value >> bits)
+      bits++;
+    return bits;
+  }
 
-        cout << "fuzzySetName - " << fuzzySetName << endl;
-        // Use AND and OR operations to combine the input membership values according to the rules
-        if (fuzzySetName == "AND" || fuzzySetName == "and")
-          andFlag = true;
-        else if (fuzzySetName == "OR" || fuzzySetName == "or")
-          orFlag = true;
-        else
-        {
-          if (inputMembershipValues.find(fuzzySetName) !=
-              inputMembershipValues.end())
-          {
-            double currentValue = inputMembershipValues[fuzzySetName];
+  // Helper to append a field of at most 32 bits to a stream
+  static void writeBits(vector<unsigned char> &stream, size_t &pos, uint64_t value, int count)
+  {
+    size_t needed = (pos + count + 7) / 8 + sizeof(uint64_t);
+    if (stream.size() < needed)
+      stream.resize(needed, 0);
+    uint64_t word;
+    memcpy(&word, &stream[pos >> 3], sizeof(word));
+    word |= value << (pos & 7);
+    memcpy(&stream[pos >> 3], &word, sizeof(word));
+    pos += count;
+  }
 
-            if (andFlag)
-            {
-              andFlag = false;
-              accum = fAnd(currentValue, accum); // Calculate the AND operation
-            }
-            else if (orFlag)
-            {
-              orFlag = false;
-              accum = fOr(currentValue, accum); // Calculate the OR operation
-            }
-            else
-            {
-              accum = currentValue; // First value of the rule
-            }
-          }
-        }
+  // Helper to read a field of at most 32 bits that starts at a bit position
+  static unsigned readBits(const unsigned char *data, size_t pos, int count)
+  {
+    uint64_t word;
+    memcpy(&word, data + (pos >> 3), sizeof(word));
+    return (unsigned)((word >> (pos & 7)) & ((uint64_t(1) << count) - 1));
+  }
 
-        j++;
-      }
+  // Helper to get the index of a name, adding it to the dictionary if needed
+  static unsigned lookup(const string &name, vector<string> &names,
+                         map<string, unsigned> &index)
+  {
+    auto found = index.find(name);
+    if (found != index.end())
+      return found->second;
 
-      fuzzySetName = "";
+    index[name] = names.size();
+    names.push_back(name);
+    return names.size() - 1;
+  }
 
-      // Get the name of the output fuzzy set
-      while (j < rule.length())
-      {
-        fuzzySetName += rule[j];
-        j++;
-      }
+  // Helper to append a rule with the current widths
+  void append(const vector<unsigned> &terms, const vector<RuleOp> &ops, unsigned output)
+  {
+    bool hasOr = false;
+    for (RuleOp op : ops)
+      hasOr = hasOr || op == OR_OP;
 
-      cout << "fuzzySetName - " << fuzzySetName << endl;
+    size_t headerPos = ruleCount * (1 + arityBits);
+    writeBits(headers, headerPos, hasOr ? 1 : 0, 1);
+    writeBits(headers, headerPos, terms.size() - 1, arityBits);
+    if (hasOr)
+      for (RuleOp op : ops)
+        writeBits(bodies, bodyBits, op == OR_OP ? 1 : 0, 1);
+    for (unsigned term : terms)
+      writeBits(bodies, bodyBits, term, termBits);
+    writeBits(bodies, bodyBits, output, outputBits);
+    ruleCount++;
+  }
+
+  // Helper to decode a rule given its index and the position of its body
+  // Returns the position of the next body
+  size_t decode(size_t rule, size_t body, vector<unsigned> &terms,
+                vector<RuleOp> &ops, unsigned &output) const
+  {
+    unsigned header = readBits(headers.data(), rule * (1 + arityBits), 1 + arityBits);
+    size_t arity = (header >> 1) + 1;
 
-      // Insert the result into the multimap storing the output values
-      outputMembershipValues.insert(pair<string, double>(fuzzySetName, accum));
+    ops.assign(arity - 1, AND_OP);
+    if (header & 1)
+    {
+      for (size_t i = 0; i + 1 < arity; i++)
+        if (readBits(bodies.data(), body + i, 1))
+          ops[i] = OR_OP;
+      body += arity - 1;
     }
 
-    // Calculate the maximum of the output membership values for each output fuzzy set
-    map<string, double> output;
-    string currentSet = "";
-    double maximum = 0;
+    terms.resize(arity);
+    for (size_t i = 0; i < arity; i++, body += termBits)
+      terms[i] = readBits(bodies.data(), body, termBits);
+    output = readBits(bodies.data(), body, outputBits);
+    return body + outputBits;
+  }
+
+  // Helper to re-encode every rule with wider fields
+  void repack(int newArityBits, int newTermBits, int newOutputBits)
+  {
+    CompactRuleStore packed;
+    packed.arityBits = newArityBits;
+    packed.termBits = newTermBits;
+    packed.outputBits = newOutputBits;
 
-    for (multimap<string, double>::iterator itr =
-             outputMembershipValues.begin();
-         itr != outputMembershipValues.end(); ++itr)
+    vector<unsigned> terms;
+    vector<RuleOp> ops;
+    unsigned output;
+    for (size_t rule = 0, body = 0; rule < ruleCount; rule++)
     {
-      if ((*itr).first != currentSet)
-      {
-        maximum = 0;
-        currentSet = (*itr).first;
-      }
+      body = decode(rule, body, terms, ops, output);
+      packed.append(terms, ops, output);
+    }
+
+    headers.swap(packed.headers);
+    bodies.swap(packed.bodies);
+    bodyBits = packed.bodyBits;
+    arityBits = newArityBits;
+    termBits = newTermBits;
+    outputBits = newOutputBits;
+  }
+
+public:
+  // Class to decode the stored rules in storage order
+  class Reader
+  {
+  private:
+    const CompactRuleStore &store; // Store being read
+    size_t rule = 0;               // Index of the next rule
+    size_t body = 0;               // Bit position of its body
 
-      maximum = max(maximum, (*itr).second);
-      output[currentSet] = maximum;
+  public:
+    Reader(const CompactRuleStore &s) : store(s) {}
+
+    // Method to decode the next rule into its term indices, connectives
+    // and output index
+    // Returns false once every rule was read
+    bool next(vector<unsigned> &terms, vector<RuleOp> &ops, unsigned &output)
+    {
+      if (rule >= store.ruleCount)
+        return false;
+      body = store.decode(rule++, body, terms, ops, output);
+      return true;
     }
+  };
 
-    // Add the maximum of the last output fuzzy set
-    output[currentSet] = maximum;
+  // Method to get the dictionary index of a term, adding it if needed
+  unsigned addTerm(const string &name) { return lookup(name, termNames, termIndex); }
 
-    return output; // Return the output membership values
+  // Method to get the dictionary index of an output, adding it if needed
+  unsigned addOutput(const string &name) { return lookup(name, outputNames, outputIndex); }
+
+  // Method to encode a rule given by dictionary indices and append it
+  // The fields are widened first if the rule does not fit them
+  void add(const vector<unsigned> &terms, const vector<RuleOp> &ops, unsigned output)
+  {
+    unsigned largest = 0;
+    for (unsigned term : terms)
+      largest = max(largest, term);
+    int newArityBits = max(arityBits, bitsFor(terms.size() - 1));
+    int newTermBits = max(termBits, bitsFor(largest));
+    int newOutputBits = max(outputBits, bitsFor(output));
+    if (newArityBits != arityBits || newTermBits != termBits || newOutputBits != outputBits)
+      repack(newArityBits, newTermBits, newOutputBits);
+
+    append(terms, ops, output);
   }
-};
 
-// Function to read the rules from a file
-// Adds them to the Rules object
-// Takes the filename and the Rules object as arguments
-void readRulesFromFile(const std::string &filename, Rules &rules)
-{
-  // Open the file in read mode
-  std::ifstream file(filename);
-  // String used to store each line of the file
-  std::string rule;
+  // Method to encode a parsed rule and append it to the store
+  void add(const vector<string> &terms, const vector<RuleOp> &ops,
+           const string &consequent)
+  {
+    // Convert the names into dictionary indices
+    vector<unsigned> indices;
+    for (const auto &term : terms)
+      indices.push_back(addTerm(term));
+    add(indices, ops, addOutput(consequent));
+  }
 
-  // Check if the file was opened successfully
-  if (file.is_open())
+  // Method to parse a rule string and append it to the store
+  // Returns false if the line is not a well formed rule
+  bool add(const string &line)
   {
-    // Read each line of the file and add it to the rule variable
-    while (std::getline(file, rule))
-    {
-      rules.addRule(rule); // Add the rule to the Rules object
-    }
-    // Close the file
-    file.close();
+    vector<string> terms;
+    vector<RuleOp> ops;
+    string consequent;
+
+    if (!parseRule(line, terms, ops, consequent))
+      return false;
+
+    add(terms, ops, consequent);
+    return true;
   }
-  else
+
+  // Method to rebuild the rule string of a decoded rule
+  string ruleString(const vector<unsigned> &terms, const vector<RuleOp> &ops,
+                    unsigned output) const
   {
-    std::cerr << "Error: Unable to open file " << filename << std::endl;
+    string rule = "IF " + termNames[terms[0]];
+    for (size_t i = 1; i < terms.size(); i++)
+      rule += (ops[i - 1] == AND_OP ? " AND " : " OR ") + termNames[terms[i]];
+    return rule + " THEN " + outputNames[output];
   }
-}
 
-// Function to read the fuzzy sets from a file
-// Initializes them in vectors of fuzzy sets
-// Takes the filename as an argument
+  // Method to evaluate every encoded rule in one sequential pass
+  // Takes the membership degree of every dictionary term as an argument
+  // Calls onRule(strength, outputIndex) for each rule in storage order
+  // Antecedents are folded from left to right like the rule reads. The
+  // fold short-circuits: a term is not loaded when the accumulator is
+  // already 0 before an AND or 1 before an OR, and rules that only use AND
+  // stop at the first term with degree 0. Skipped terms cost nothing to
+  // step over since every field position follows from the header
+  template <class F>
+  void evaluate(const vector<double> &termDegrees, F onRule) const
+  {
+    const unsigned char *headerData = headers.data();
+    const unsigned char *bodyData = bodies.data();
+    const double *degrees = termDegrees.data();
+    const int headerBits = 1 + arityBits;
+    size_t body = 0;
+    for (size_t rule = 0, headerPos = 0; rule < ruleCount; rule++, headerPos += headerBits)
+    {
+      unsigned header = readBits(headerData, headerPos, headerBits);
+      size_t arity = (header >> 1) + 1;
+      size_t opPos = body;
+      size_t termPos = body + ((header & 1) ? arity - 1 : 0);
+      size_t outputPos = termPos + arity * termBits;
+      body = outputPos + outputBits;
+
+      double accum = degrees[readBits(bodyData, termPos, termBits)];
+      if (!(header & 1))
+      {
+        for (size_t i = 1; i < arity && accum > 0; i++)
+          accum = fAnd(degrees[readBits(bodyData, termPos + i * termBits, termBits)], accum);
+      }
+      else
+      {
+        for (size_t i = 1; i < arity; i++)
+        {
+          if (readBits(bodyData, opPos + i - 1, 1))
+          {
+            if (accum < 1)
+              accum = fOr(degrees[readBits(bodyData, termPos + i * termBits, termBits)], accum);
+          }
+          else if (accum > 0)
+            accum = fAnd(degrees[readBits(bodyData, termPos + i * termBits, termBits)], accum);
+        }
+      }
+
+      onRule(accum, readBits(bodyData, outputPos, outputBits));
+    }
+  }
+
+  // Method to perform Mamdani inference over the encoded rules
+  // Takes the membership degree of every dictionary term as an argument
+  // Stores the maximum firing strength of every output set in outputDegrees
+  void infer(const vector<double> &termDegrees,
+             vector<double> &outputDegrees) const
+  {
+    outputDegrees.assign(outputNames.size(), 0);
+    evaluate(termDegrees, [&](double strength, unsigned output)
+             { outputDegrees[output] = max(outputDegrees[output], strength); });
+  }
+
+  // Method to empty the store
+  void clear()
+  {
+    headers.clear();
+    headers.shrink_to_fit();
+    bodies.clear();
+    bodies.shrink_to_fit();
+    bodyBits = 0;
+    arityBits = termBits = outputBits = 0;
+    termNames.clear();
+    termIndex.clear();
+    outputNames.clear();
+    outputIndex.clear();
+    ruleCount = 0;
+  }
+
+  // Method to get the number of stored rules
+  size_t size() const { return ruleCount; }
+
+  // Method to get the memory used by the encoded rules, padding included
+  size_t encodedBytes() const { return headers.size() + bodies.size(); }
+
+  // Method to get the approximate memory used by the name dictionaries
+  size_t dictionaryBytes() const
+  {
+    size_t total = 0;
+    for (const auto &name : termNames)
+      total += name.size() + sizeof(string) + sizeof(unsigned);
+    for (const auto &name : outputNames)
+      total += name.size() + sizeof(string) + sizeof(unsigned);
+    return total;
+  }
+
+  // Methods to access the name dictionaries
+  const vector<string> &getTermNames() const { return termNames; }
+  const vector<string> &getOutputNames() const { return outputNames; }
+};
+
+/******* Selectivity Profiles *******/
+// Class to record how often every term is 0 or 1 in real traffic
+// Rules::orderBySelectivity uses it so that the compiled evaluator meets
+// the terms that decide a rule first and short-circuits earlier
+// The profile is saved next to the model as lines of the form
+// "TermName zeroCount oneCount sampleCount"
+class SelectivityProfile
+{
+private:
+  // Counters kept for every term
+  struct Counts
+  {
+    size_t zeros = 0;   // Evaluations with degree 0
+    size_t ones = 0;    // Evaluations with degree 1
+    size_t samples = 0; // Total evaluations
+  };
+
+  map<string, Counts> counts; // Counters of every recorded term
+
+public:
+  // Method to record the membership values of one inference
+  void record(const map<string, double> &inputMembershipValues)
+  {
+    for (const auto &pair : inputMembershipValues)
+    {
+      Counts &c = counts[pair.first];
+      c.zeros += pair.second <= 0;
+      c.ones += pair.second >= 1;
+      c.samples++;
+    }
+  }
+
+  // Method to get the fraction of the samples in which a term was 0
+  // Terms never recorded get 0
+  double zeroRate(const string &term) const
+  {
+    auto found = counts.find(term);
+    if (found == counts.end() || found->second.samples == 0)
+      return 0;
+    return (double)found->second.zeros / found->second.samples;
+  }
+
+  // Method to get the fraction of the samples in which a term was 1
+  // Terms never recorded get 0
+  double oneRate(const string &term) const
+  {
+    auto found = counts.find(term);
+    if (found == counts.end() || found->second.samples == 0)
+      return 0;
+    return (double)found->second.ones / found->second.samples;
+  }
+
+  // Method to check if anything was recorded
+  bool empty() const { return counts.empty(); }
+
+  // Method to write the profile to a file
+  // Returns false if the file cannot be written
+  bool save(const string &filename) const
+  {
+    ofstream file(filename);
+    if (!file.is_open())
+      return false;
+
+    for (const auto &pair : counts)
+      file << pair.first << " " << pair.second.zeros << " "
+           << pair.second.ones << " " << pair.second.samples << "\n";
+    return true;
+  }
+
+  // Method to read a profile written by save, adding to the current counts
+  // Returns false if the file cannot be opened
+  bool load(const string &filename)
+  {
+    ifstream file(filename);
+    if (!file.is_open())
+      return false;
+
+    string line;
+    while (getline(file, line))
+    {
+      istringstream iss(line);
+      string term;
+      Counts c;
+      if (iss >> term >> c.zeros >> c.ones >> c.samples)
+      {
+        counts[term].zeros += c.zeros;
+        counts[term].ones += c.ones;
+        counts[term].samples += c.samples;
+      }
+    }
+    return true;
+  }
+};
+
+/******* Grid Rule Bases *******/
+// Class to store a complete grid rule base
+// Generated rule bases often contain one "IF A_i AND B_j ... THEN C_k" rule
+// for every combination of terms. In that case the consequents are stored as
+// a dense d-dimensional tensor of output indices instead of encoded rules,
+// and inference only visits the cells whose antecedents are all non zero
+class GridRuleBase
+{
+private:
+  vector<vector<string>> dimTerms; // Terms used at each antecedent position
+  vector<size_t> strides;          // Row-major stride of each dimension
+  vector<string> outputNames;      // Names of the output fuzzy sets
+  vector<unsigned short> cells;    // Consequent index of every grid cell
+
+public:
+  // Method to build the tensor from the encoded rules
+  // Returns false (and leaves the object empty) if the rules are not a
+  // complete grid: only AND connectives, the same number of antecedents in
+  // every rule, each term used at a single position and every combination
+  // of terms present exactly once
+  bool build(const CompactRuleStore &store)
+  {
+    clear();
+
+    // Output indices must fit in a cell and stay below the EMPTY marker
+    const vector<string> &names = store.getTermNames();
+    if (store.size() == 0 || store.getOutputNames().size() >= 0xFFFF)
+      return fail();
+
+    // Position and per-dimension index of every dictionary term
+    vector<int> termDim(names.size(), -1);
+    vector<size_t> termPos(names.size(), 0);
+
+    vector<unsigned> terms;
+    vector<RuleOp> ops;
+    unsigned output;
+    size_t dims = 0;
+
+    // First pass: assign every term to a dimension
+    CompactRuleStore::Reader firstPass(store);
+    while (firstPass.next(terms, ops, output))
+    {
+      // Only pure conjunctions of the same arity form a grid
+      for (RuleOp op : ops)
+        if (op != AND_OP)
+          return fail();
+      if (dims == 0)
+      {
+        dims = terms.size();
+        dimTerms.resize(dims);
+      }
+      else if (terms.size() != dims)
+        return fail();
+
+      for (size_t d = 0; d < dims; d++)
+      {
+        if (termDim[terms[d]] == -1)
+        {
+          termDim[terms[d]] = (int)d;
+          termPos[terms[d]] = dimTerms[d].size();
+          dimTerms[d].push_back(names[terms[d]]);
+        }
+        else if (termDim[terms[d]] != (int)d)
+          return fail(); // A term used at two positions is not a grid axis
+      }
+    }
+
+    // Compute the strides and check that the rule count matches the grid size
+    strides.assign(dims, 1);
+    size_t total = 1;
+    for (size_t d = dims; d-- > 0;)
+    {
+      strides[d] = total;
+      total *= dimTerms[d].size();
+    }
+    if (total != store.size())
+      return fail();
+
+    // Second pass: fill the tensor, rejecting duplicated combinations
+    const unsigned short EMPTY = 0xFFFF;
+    cells.assign(total, EMPTY);
+    CompactRuleStore::Reader secondPass(store);
+    while (secondPass.next(terms, ops, output))
+    {
+      size_t cell = 0;
+      for (size_t d = 0; d < dims; d++)
+        cell += termPos[terms[d]] * strides[d];
+
+      if (cells[cell] != EMPTY)
+        return fail();
+      cells[cell] = (unsigned short)output;
+    }
+
+    outputNames = store.getOutputNames();
+    return true;
+  }
+
+  // Method to empty the tensor
+  void clear()
+  {
+    dimTerms.clear();
+    strides.clear();
+    outputNames.clear();
+    cells.clear();
+  }
+
+  // Method to check if the tensor holds a rule base
+  bool empty() const { return cells.empty(); }
+
+  // Method to get the number of rules stored in the tensor
+  size_t size() const { return cells.size(); }
+
+  // Method to get the number of antecedent dimensions
+  size_t dimensions() const { return dimTerms.size(); }
+
+  // Method to get the number of terms of a dimension
+  size_t dimensionSize(size_t d) const { return dimTerms[d].size(); }
+
+  // Method to get the memory used by the tensor in bytes
+  size_t tensorBytes() const { return cells.size() * sizeof(cells[0]); }
+
+  // Method to rebuild the rule string stored at a given cell
+  string ruleAt(size_t cell) const
+  {
+    string rule = "IF";
+    for (size_t d = 0; d < dimTerms.size(); d++)
+    {
+      if (d > 0)
+        rule += " AND";
+      rule += " " + dimTerms[d][(cell / strides[d]) % dimTerms[d].size()];
+    }
+    return rule + " THEN " + outputNames[cells[cell]];
+  }
+
+  // Method to visit every cell that can fire for the given memberships
+  // Calls onCell(strength, outputIndex) for each of them and returns the
+  // number of cells visited
+  // Only the cells whose terms are all non zero can fire, so the odometer
+  // below walks the product of the non zero terms of every dimension.
+  // With strong partitions at most two terms per dimension are non zero and
+  // at most 2^d cells are visited. Terms missing from the map count as 0
+  template <class F>
+  size_t visit(const map<string, double> &inputMembershipValues, F onCell) const
+  {
+    size_t dims = dimTerms.size();
+
+    // Offsets and degrees of the non zero terms of each dimension
+    vector<vector<size_t>> offsets(dims);
+    vector<vector<double>> degrees(dims);
+
+    for (size_t d = 0; d < dims; d++)
+    {
+      for (size_t t = 0; t < dimTerms[d].size(); t++)
+      {
+        auto found = inputMembershipValues.find(dimTerms[d][t]);
+        if (found != inputMembershipValues.end() && found->second > 0)
+        {
+          offsets[d].push_back(t * strides[d]);
+          degrees[d].push_back(found->second);
+        }
+      }
+      if (offsets[d].empty())
+        return 0; // No cell can fire
+    }
+
+    size_t steps = 0;
+    vector<size_t> position(dims, 0);
+    while (true)
+    {
+      // Firing strength of the current cell
+      size_t cell = 0;
+      double strength = 1;
+      for (size_t d = 0; d < dims; d++)
+      {
+        cell += offsets[d][position[d]];
+        strength = fAnd(strength, degrees[d][position[d]]);
+      }
+
+      onCell(strength, (unsigned)cells[cell]);
+      steps++;
+
+      // Advance the odometer to the next combination of non zero terms
+      size_t d = dims;
+      while (d-- > 0)
+      {
+        if (++position[d] < offsets[d].size())
+          break;
+        position[d] = 0;
+      }
+      if (d == (size_t)-1)
+        break;
+    }
+    return steps;
+  }
+
+  // Method to perform Mamdani inference over the tensor
+  // Takes a map containing the input membership values as an argument
+  // Returns a map containing the output membership values
+  map<string, double> infer(const map<string, double> &inputMembershipValues) const
+  {
+    vector<double> outputDegrees(outputNames.size(), 0);
+
+    // Maximum aggregation into the consequent of every visited cell
+    visit(inputMembershipValues, [&](double strength, unsigned out)
+          { outputDegrees[out] = fOr(outputDegrees[out], strength); });
+
+    map<string, double> output;
+    for (size_t k = 0; k < outputNames.size(); k++)
+      output[outputNames[k]] = outputDegrees[k];
+
+    return output; // Return the output membership values
+  }
+
+  // Method to get the names of the output fuzzy sets
+  const vector<string> &getOutputNames() const { return outputNames; }
+
+private:
+  // Helper used by build to discard a partially built tensor
+  bool fail()
+  {
+    clear();
+    return false;
+  }
+};
+
+/******* Antecedent DAG *******/
+// Class to compile the antecedents of all rules into one DAG
+// Every distinct sub-expression becomes a single node that is evaluated once
+// per inference, no matter how many rules use it. Runs of the same
+// connective are flattened and their operands sorted before the nodes are
+// built, so "A AND B AND C" and "B AND A AND D" share the node "A AND B".
+// Parenthesized expressions such as "IF (A OR B) AND C THEN D" are accepted;
+// without parentheses connectives are applied from left to right like in
+// Rules::inferMamdani
+class RuleDag
+{
+private:
+  // Node of the DAG
+  // Leaves have op -1 and left holding the term index, the other nodes
+  // combine the values of the left and right nodes with AND_OP or OR_OP
+  struct Node
+  {
+    int op;
+    int left;
+    int right;
+  };
+
+  // Parsed expression used while compiling a rule
+  // Leaves have op -1 and term set, the other expressions apply op to all
+  // of their arguments
+  struct Expr
+  {
+    int op;
+    int term;
+    vector<Expr> args;
+  };
+
+  vector<Node> nodes;                       // Nodes in evaluation order
+  map<vector<int>, int> nodeIndex;          // Index of each distinct node
+  vector<string> termNames;                 // Names of the leaf terms
+  map<string, int> termIndex;               // Index of each term name
+  vector<string> outputNames;               // Names of the output sets
+  map<string, int> outputIndex;             // Index of each output name
+  vector<int> ruleRoot;                     // Root node of each rule
+  vector<int> ruleOutput;                   // Output set of each rule
+  size_t unsharedOps = 0;                   // Operations without sharing
+  vector<double> values;                    // Node values of the last inference
+
+  // Helper to split a line into words, parentheses being words on their own
+  static vector<string> tokenize(const string &line)
+  {
+    vector<string> tokens;
+    string current;
+    for (char c : line)
+    {
+      if (c == '(' || c == ')' || isspace((unsigned char)c))
+      {
+        if (!current.empty())
+          tokens.push_back(current);
+        current = "";
+        if (c == '(' || c == ')')
+          tokens.push_back(string(1, c));
+      }
+      else
+        current += c;
+    }
+    if (!current.empty())
+      tokens.push_back(current);
+    return tokens;
+  }
+
+  // Helper to append an operand to an expression, flattening runs of the
+  // same connective so that associativity can be exploited
+  static void appendOperand(Expr &expr, Expr &operand)
+  {
+    if (operand.op == expr.op)
+      for (auto &arg : operand.args)
+        expr.args.push_back(arg);
+    else
+      expr.args.push_back(operand);
+  }
+
+  // Recursive descent parser for expr := operand ((AND | OR) operand)*
+  // Returns false if the tokens do not form a valid expression
+  bool parseExpr(const vector<string> &tokens, size_t &pos, Expr &result)
+  {
+    if (!parseOperand(tokens, pos, result))
+      return false;
+
+    while (pos < tokens.size())
+    {
+      const string &word = tokens[pos];
+      int op;
+      if (word == "AND" || word == "and")
+        op = AND_OP;
+      else if (word == "OR" || word == "or")
+        op = OR_OP;
+      else
+        break;
+      pos++;
+
+      Expr operand;
+      if (!parseOperand(tokens, pos, operand))
+        return false;
+
+      // Connectives are applied from left to right
+      if (result.op != op)
+      {
+        Expr combined = {op, -1, {}};
+        appendOperand(combined, result);
+        result = combined;
+      }
+      appendOperand(result, operand);
+    }
+    return true;
+  }
+
+  // Parser for operand := TERM | "(" expr ")"
+  bool parseOperand(const vector<string> &tokens, size_t &pos, Expr &result)
+  {
+    if (pos >= tokens.size())
+      return false;
+
+    const string &word = tokens[pos++];
+    if (word == "(")
+    {
+      if (!parseExpr(tokens, pos, result) || pos >= tokens.size() ||
+          tokens[pos] != ")")
+        return false;
+      pos++;
+      return true;
+    }
+    if (word == ")" || word == "AND" || word == "and" || word == "OR" ||
+        word == "or" || word == "THEN" || word == "then")
+      return false;
+
+    auto found = termIndex.find(word);
+    int term = found != termIndex.end() ? found->second : -1;
+    if (term == -1)
+    {
+      term = termNames.size();
+      termIndex[word] = term;
+      termNames.push_back(word);
+    }
+    result = {-1, term, {}};
+    return true;
+  }
+
+  // Helper to get the node for an operation, creating it only if no equal
+  // node exists. Operands are ordered since AND and OR are commutative
+  int makeNode(int op, int left, int right)
+  {
+    if (op != -1 && left > right)
+      swap(left, right);
+
+    vector<int> key = {op, left, right};
+    auto found = nodeIndex.find(key);
+    if (found != nodeIndex.end())
+      return found->second;
+
+    nodes.push_back({op, left, right});
+    nodeIndex[key] = nodes.size() - 1;
+    return nodes.size() - 1;
+  }
+
+  // Helper to build the nodes of an expression
+  // Counts in unsharedOps the operations a rule by rule evaluation performs
+  // Returns the node holding the value of the expression
+  int build(const Expr &expr)
+  {
+    if (expr.op == -1)
+      return makeNode(-1, expr.term, -1);
+
+    vector<int> operands;
+    for (const auto &arg : expr.args)
+      operands.push_back(build(arg));
+    unsharedOps += operands.size() - 1;
+
+    // Sorted operands give equal prefixes to rules that share terms
+    sort(operands.begin(), operands.end());
+    int node = operands[0];
+    for (size_t i = 1; i < operands.size(); i++)
+      node = makeNode(expr.op, node, operands[i]);
+    return node;
+  }
+
+public:
+  // Method to compile a rule and add it to the DAG
+  // Returns false if the line is not a well formed rule
+  bool addRule(const string &line)
+  {
+    vector<string> tokens = tokenize(line);
+    if (tokens.size() < 4 || (tokens[0] != "IF" && tokens[0] != "if"))
+      return false;
+
+    size_t pos = 1;
+    Expr expr;
+    size_t termCount = termNames.size();
+    if (!parseExpr(tokens, pos, expr) || pos + 2 != tokens.size() ||
+        (tokens[pos] != "THEN" && tokens[pos] != "then"))
+    {
+      // Forget the terms registered by the rejected rule
+      for (size_t t = termCount; t < termNames.size(); t++)
+        termIndex.erase(termNames[t]);
+      termNames.resize(termCount);
+      return false;
+    }
+
+    const string &consequent = tokens[pos + 1];
+    if (outputIndex.find(consequent) == outputIndex.end())
+    {
+      outputIndex[consequent] = outputNames.size();
+      outputNames.push_back(consequent);
+    }
+
+    ruleRoot.push_back(build(expr));
+    ruleOutput.push_back(outputIndex[consequent]);
+    return true;
+  }
+
+  // Method to get the number of compiled rules
+  size_t size() const { return ruleRoot.size(); }
+
+  // Method to get the number of nodes of the DAG
+  size_t nodeCount() const { return nodes.size(); }
+
+  // Method to get the number of AND/OR operations performed per inference
+  size_t sharedOps() const
+  {
+    size_t ops = 0;
+    for (const auto &node : nodes)
+      if (node.op != -1)
+        ops++;
+    return ops;
+  }
+
+  // Method to get the number of operations a rule by rule evaluation needs
+  size_t unsharedOpCount() const { return unsharedOps; }
+
+  // Methods to access the name dictionaries
+  const vector<string> &getTermNames() const { return termNames; }
+  const vector<string> &getOutputNames() const { return outputNames; }
+
+  // Method to perform Mamdani inference over the DAG
+  // Takes the membership degree of every term, in the order of getTermNames()
+  // Stores the maximum firing strength of every output set in outputDegrees
+  void infer(const vector<double> &termDegrees, vector<double> &outputDegrees)
+  {
+    values.resize(nodes.size());
+
+    // Nodes are created after their operands, so one pass evaluates them all
+    for (size_t n = 0; n < nodes.size(); n++)
+    {
+      const Node &node = nodes[n];
+      if (node.op == -1)
+        values[n] = termDegrees[node.left];
+      else if (node.op == AND_OP)
+        values[n] = fAnd(values[node.left], values[node.right]);
+      else
+        values[n] = fOr(values[node.left], values[node.right]);
+    }
+
+    // Maximum aggregation of the rule roots into their output sets
+    outputDegrees.assign(outputNames.size(), 0);
+    for (size_t r = 0; r < ruleRoot.size(); r++)
+      outputDegrees[ruleOutput[r]] =
+          max(outputDegrees[ruleOutput[r]], values[ruleRoot[r]]);
+  }
+
+  // Method to perform Mamdani inference from named membership values
+  // Returns a map containing the output membership values
+  // Terms missing from the map count as 0
+  map<string, double> inferMamdani(const map<string, double> &inputMembershipValues)
+  {
+    vector<double> termDegrees(termNames.size(), 0);
+    for (size_t t = 0; t < termNames.size(); t++)
+    {
+      auto found = inputMembershipValues.find(termNames[t]);
+      if (found != inputMembershipValues.end())
+        termDegrees[t] = found->second;
+    }
+
+    vector<double> outputDegrees;
+    infer(termDegrees, outputDegrees);
+
+    map<string, double> output;
+    for (size_t k = 0; k < outputNames.size(); k++)
+      output[outputNames[k]] = outputDegrees[k];
+
+    return output; // Return the output membership values
+  }
+};
+
+// Class to handle fuzzy rules
+// Rules are kept in a CompactRuleStore, or as a GridRuleBase when they form
+// a complete grid, never as the original strings
+class Rules
+{
+private:
+  CompactRuleStore store; // Encoded rules
+  GridRuleBase grid;      // Dense storage used when the rules form a full grid
+
+public:
+  // Method to add a rule to the rule set
+  // Blank lines are ignored and malformed rules are reported and skipped
+  void addRule(string r)
+  {
+    if (r.find_first_not_of(" \t\r") == string::npos)
+      return;
+
+    // Rules added after a grid was detected go back to the encoded storage
+    if (!grid.empty())
+    {
+      for (size_t cell = 0; cell < grid.size(); cell++)
+        store.add(grid.ruleAt(cell));
+      grid.clear();
+    }
+
+    // Rules with several consequents are stored once per consequent
+    vector<string> rules = splitConsequents(r);
+    if (rules.empty())
+      std::cerr << "Warning: skipping malformed rule: " << r << std::endl;
+    for (const auto &rule : rules)
+      if (!store.add(rule))
+        std::cerr << "Warning: skipping malformed rule: " << rule << std::endl;
+  }
+
+  // Method to detect a complete grid rule base
+  // On success the encoded rules are released and the rules are kept only
+  // as a tensor of consequent indices
+  // Returns true if the rules are stored as a grid
+  bool compileGrid()
+  {
+    if (grid.empty() && grid.build(store))
+      store.clear();
+    return !grid.empty();
+  }
+
+  // Method to reorder the antecedents of every rule by selectivity
+  // Within each run of the same connective the terms are commutative, so
+  // AND runs are sorted by how often the term is 0 and OR runs by how often
+  // it is 1, most decisive first. Grid rule bases already skip zero terms
+  // and are left untouched
+  // Returns true if the encoded rules were rewritten
+  bool orderBySelectivity(const SelectivityProfile &profile)
+  {
+    if (!grid.empty() || store.size() == 0)
+      return false;
+
+    CompactRuleStore ordered;
+    const vector<string> &termNames = store.getTermNames();
+    const vector<string> &outputNames = store.getOutputNames();
+    vector<unsigned> indices;
+    vector<RuleOp> ops;
+    unsigned output;
+
+    CompactRuleStore::Reader reader(store);
+    while (reader.next(indices, ops, output))
+    {
+      vector<string> terms;
+      for (unsigned t : indices)
+        terms.push_back(termNames[t]);
+
+      // Sort every run of terms joined by the same connective
+      for (size_t start = 0; start < terms.size();)
+      {
+        RuleOp op = start == 0 ? (ops.empty() ? AND_OP : ops[0]) : ops[start - 1];
+        size_t end = start;
+        while (end + 1 < terms.size() && ops[end] == op)
+          end++;
+
+        stable_sort(terms.begin() + start, terms.begin() + end + 1,
+                    [&](const string &a, const string &b)
+                    {
+                      if (op == AND_OP)
+                        return profile.zeroRate(a) > profile.zeroRate(b);
+                      return profile.oneRate(a) > profile.oneRate(b);
+                    });
+        start = end + 1;
+      }
+
+      ordered.add(terms, ops, outputNames[output]);
+    }
+
+    store = ordered;
+    return true;
+  }
+
+  // Method to call f(terms, ops, consequent) for every stored rule
+  // terms holds the antecedent names and ops the connectives between them
+  template <class F>
+  void forEachRule(F f) const
+  {
+    vector<string> terms;
+    vector<RuleOp> ops;
+    string consequent;
+
+    if (!grid.empty())
+    {
+      for (size_t cell = 0; cell < grid.size(); cell++)
+        if (parseRule(grid.ruleAt(cell), terms, ops, consequent))
+          f(terms, ops, consequent);
+      return;
+    }
+
+    const vector<string> &termNames = store.getTermNames();
+    const vector<string> &outputNames = store.getOutputNames();
+    vector<unsigned> indices;
+    unsigned output;
+    CompactRuleStore::Reader reader(store);
+    while (reader.next(indices, ops, output))
+    {      terms.clear();
+      for (unsigned t : indices)
+        terms.push_back(termNames[t]);
+      f(terms, ops, outputNames[output]);
+    }
+  }
+
+  // Method to compile the stored rules into an antecedent DAG
+  void compileDag(RuleDag &dag) const
+  {
+    if (!grid.empty())
+    {
+      for (size_t cell = 0; cell < grid.size(); cell++)
+        dag.addRule(grid.ruleAt(cell));
+      return;
+    }
+
+    vector<unsigned> terms;
+    vector<RuleOp> ops;
+    unsigned output;
+    CompactRuleStore::Reader reader(store);
+    while (reader.next(terms, ops, output))
+      dag.addRule(store.ruleString(terms, ops, output));
+  }
+
+  // Method to check if the rules are stored as a grid
+  bool isGrid() const { return !grid.empty(); }
+
+  // Method to get the number of stored rules
+  size_t size() const { return grid.empty() ? store.size() : grid.size(); }
+
+  // Method to get the memory used by the rule storage in bytes
+  // Includes the name dictionaries of the encoded storage
+  size_t storageBytes() const
+  {
+    if (!grid.empty())
+      return grid.tensorBytes();
+    return store.encodedBytes() + store.dictionaryBytes();
+  }
+
+  // Method to print the stored rules
+  void printRules() const
+  {
+    std::cout << "\nRead Rules: " << endl;
+    if (!grid.empty())
+    {
+      // Describe the tensor and rebuild every rule from it
+      std::cout << "(complete grid of " << grid.dimensions() << " dimensions: ";
+      for (size_t d = 0; d < grid.dimensions(); d++)
+        std::cout << (d > 0 ? " x " : "") << grid.dimensionSize(d);
+      std::cout << " terms, " << grid.tensorBytes() << " bytes)" << endl;
+
+      for (size_t cell = 0; cell < grid.size(); cell++)
+        std::cout << grid.ruleAt(cell) << std::endl;
+      return;
+    }
+
+    vector<unsigned> terms;
+    vector<RuleOp> ops;
+    unsigned output;
+    CompactRuleStore::Reader reader(store);
+    while (reader.next(terms, ops, output))
+      std::cout << store.ruleString(terms, ops, output) << std::endl;
+  }
+
+  // Method to get the names of the output fuzzy sets used by the rules
+  const vector<string> &getOutputNames() const
+  {
+    return grid.empty() ? store.getOutputNames() : grid.getOutputNames();
+  }
+
+  // Method to compute the firing strength of the rules
+  // Takes a map containing the input membership values as an argument
+  // Fills firings with one (strength, output index) pair per rule that can
+  // fire; rules left out have strength 0. Output indices refer to
+  // getOutputNames(). Terms missing from the map count as 0
+  void fireRules(const map<string, double> &inputMembershipValues,
+                 vector<pair<double, unsigned>> &firings) const
+  {
+    firings.clear();
+    auto collect = [&](double strength, unsigned output)
+    { firings.push_back(make_pair(strength, output)); };
+
+    if (!grid.empty())
+      grid.visit(inputMembershipValues, collect);
+    else
+      store.evaluate(termDegreesOf(inputMembershipValues), collect);
+  }
+
+  // Method to perform Mamdani inference
+  // Takes a map containing the input membership values as an argument
+  // Returns a map containing the output membership values
+  // Maximum membership is used. Terms missing from the map count as 0
+  map<string, double> inferMamdani(map<string, double> inputMembershipValues) const
+  {
+    // Grid rule bases only visit the cells around the input
+    if (!grid.empty())
+      return grid.infer(inputMembershipValues);
+
+    // Stream the encoded rules through the evaluator
+    vector<double> outputDegrees;
+    store.infer(termDegreesOf(inputMembershipValues), outputDegrees);
+
+    map<string, double> output;
+    const vector<string> &outputNames = store.getOutputNames();
+    for (size_t k = 0; k < outputNames.size(); k++)
+      output[outputNames[k]] = outputDegrees[k];
+
+    return output; // Return the output membership values
+  }
+
+private:
+  // Helper to resolve the degree of every dictionary term once
+  vector<double> termDegreesOf(const map<string, double> &inputMembershipValues) const
+  {
+    const vector<string> &termNames = store.getTermNames();
+    vector<double> termDegrees(termNames.size(), 0);
+    for (size_t t = 0; t < termNames.size(); t++)
+    {
+      auto found = inputMembershipValues.find(termNames[t]);
+      if (found != inputMembershipValues.end())
+        termDegrees[t] = found->second;
+    }
+    return termDegrees;
+  }
+};
+
+/******* Defuzzification *******/
+// Number of evenly spaced samples used to integrate over the output universe
+const int DEFUZZ_SAMPLES = 1001;
+
+// Function to get the universe of discourse covered by the output sets
+// Stores in lo and hi the union of the ranges of all the sets
+void outputUniverse(const vector<OutputFuzzySet> &outputSets, double &lo,
+                    double &hi)
+{
+  lo = HUGE_VAL;
+  hi = -HUGE_VAL;
+  for (const auto &outputSet : outputSets)
+  {
+    double setLo, setHi;
+    outputSet.getRange(setLo, setHi);
+    lo = min(lo, setLo);
+    hi = max(hi, setHi);
+  }
+  if (lo > hi)
+    lo = hi = 0; // No output set has a shape
+}
+
+// Function to know if every output set is a singleton
+bool allSingletons(const vector<OutputFuzzySet> &outputSets)
+{
+  for (const auto &outputSet : outputSets)
+    if (!outputSet.isSingleton())
+      return false;
+  return true;
+}
+
+// Function to defuzzify singleton output sets
+// The crisp output is the average of the singleton positions weighted by
+// their activations, in O(number of output sets) with no sampling
+// If area is not null it receives the sum of the activations
+// mode selects how the sums are taken
+// Returns the middle of the universe if no output set is active
+double defuzzifySingletons(const vector<OutputFuzzySet> &outputSets,
+                           const double *activation, double *area = nullptr,
+                           ReductionMode mode = FAST_REDUCTION)
+{
+  double numerator = 0, denominator = 0, lo = HUGE_VAL, hi = -HUGE_VAL;
+  bool deterministic = mode == DETERMINISTIC_REDUCTION;
+  vector<double> positions(deterministic ? outputSets.size() : 0);
+  for (size_t k = 0; k < outputSets.size(); k++)
+  {
+    double position = outputSets[k].getPosition();
+    if (deterministic)
+      positions[k] = position;
+    else
+    {
+      numerator += activation[k] * position;
+      denominator += activation[k];
+    }
+    lo = min(lo, position);
+    hi = max(hi, position);
+  }
+  if (deterministic)
+  {
+    numerator = reproducibleDot(activation, positions.data(), outputSets.size());
+    denominator = reproducibleSum(activation, outputSets.size());
+  }
+
+  if (area)
+    *area = denominator;
+  if (denominator <= 0)
+    return outputSets.empty() ? 0 : (lo + hi) / 2;
+  return numerator / denominator;
+}
+
+// Function to compute the centroid of the aggregated output
+// activation[k] is the activation of outputSets[k]; extra entries are
+// ignored. Each output set is clipped at its activation (min implication)
+// and the clipped sets are combined with max aggregation, sampled at
+// DEFUZZ_SAMPLES points
+// Models whose output sets are all singletons use defuzzifySingletons
+// instead. Singletons mixed with other sets have no area and are ignored
+// If area is not null it receives the sum of the aggregated samples
+// mode selects how the centroid sums are taken
+// Returns the middle of the universe if no output set is active
+double defuzzifyCentroid(const vector<OutputFuzzySet> &outputSets,
+                         const double *activation, double *area = nullptr,
+                         ReductionMode mode = FAST_REDUCTION)
+{
+  if (allSingletons(outputSets))
+    return defuzzifySingletons(outputSets, activation, area, mode);
+
+  double lo, hi;
+  outputUniverse(outputSets, lo, hi);
+
+  // Skip the inactive output sets and the singletons
+  vector<size_t> active;
+  for (size_t k = 0; k < outputSets.size(); k++)
+    if (activation[k] > 0 && !outputSets[k].isSingleton())
+      active.push_back(k);
+
+  double step = (hi - lo) / (DEFUZZ_SAMPLES - 1);
+  double numerator = 0, denominator = 0;
+  bool deterministic = mode == DETERMINISTIC_REDUCTION;
+  vector<double> sampleX, sampleMu;
+  for (int i = 0; i < DEFUZZ_SAMPLES && !active.empty(); i++)
+  {
+    double x = deterministic ? samplePoint(lo, step, i) : lo + i * step;
+    double mu = 0;
+    for (size_t k : active)
+      mu = fOr(mu, fAnd(activation[k], outputSets[k].eval(x)));
+
+    // Deterministic sums are taken once all the samples are known
+    if (deterministic)
+    {
+      sampleX.push_back(x);
+      sampleMu.push_back(mu);
+      continue;
+    }
+    numerator += x * mu;
+    denominator += mu;
+  }
+  if (deterministic)
+  {
+    numerator = reproducibleDot(sampleX.data(), sampleMu.data(), sampleMu.size());
+    denominator = reproducibleSum(sampleMu.data(), sampleMu.size());
+  }
+
+  if (area)
+    *area = denominator;
+  if (denominator <= 0)
+    return (lo + hi) / 2;
+  return numerator / denominator;
+}
+
+// Function to compute the centroid of the aggregated output from the
+// activations of the output sets by name
+// Sets missing from outputValues are inactive
+double defuzzifyCentroid(const vector<OutputFuzzySet> &outputSets,
+                         const map<string, double> &outputValues,
+                         double *area = nullptr, ReductionMode mode = FAST_REDUCTION)
+{
+  vector<double> activation(outputSets.size(), 0);
+  for (size_t k = 0; k < outputSets.size(); k++)
+  {
+    auto found = outputValues.find(outputSets[k].getName());
+    if (found != outputValues.end())
+      activation[k] = found->second;
+  }
+  return defuzzifyCentroid(outputSets, activation.data(), area, mode);
+}
+
+// Structure to hold the result of an adaptive defuzzification
+struct AdaptiveCentroid
+{
+  double crisp;         // Centroid of the aggregated output
+  double errorEstimate; // Estimated |crisp - exact centroid|
+  size_t samples;       // Evaluations of the aggregated output
+};
+
+// Function to evaluate the aggregated output of the active sets at x
+// Clipping and aggregation are those of defuzzifyCentroid
+double adaptiveMembership(const vector<OutputFuzzySet> &outputSets,
+                          const double *activation, const vector<size_t> &active,
+                          double x)
+{
+  double mu = 0;
+  for (size_t k : active)
+    mu = fOr(mu, fAnd(activation[k], outputSets[k].eval(x)));
+  return mu;
+}
+
+// Function to compute the centroid of the aggregated output with adaptive
+// sampling, to an absolute tolerance
+// Clipping and aggregation are those of defuzzifyCentroid, over the same
+// universe. The universe is first cut at the breakpoints of the active sets
+// and at the points where they cross their activation, so every piece is
+// smooth except where two clipped sets intersect. Each piece is integrated
+// with Simpson's rule on its two halves, and the difference with Simpson's
+// rule on the whole piece estimates its error. Pieces are split in rounds
+// until the estimated centroid error is at most tolerance or maxSamples is
+// reached, so the samples end up around the intersections and on the
+// curved parts of Gaussian sets
+// Models whose output sets are all singletons use defuzzifySingletons
+AdaptiveCentroid defuzzifyAdaptive(const vector<OutputFuzzySet> &outputSets,
+                                   const double *activation, double tolerance,
+                                   size_t maxSamples = 100000)
+{
+  double lo, hi;
+  outputUniverse(outputSets, lo, hi);
+  AdaptiveCentroid result = {(lo + hi) / 2, 0, 0};
+  if (allSingletons(outputSets))
+  {
+    result.crisp = defuzzifySingletons(outputSets, activation);
+    return result;
+  }
+
+  // Active sets and the points where the aggregated output has a corner
+  vector<size_t> active;
+  vector<double> cuts = {lo, hi};
+  for (size_t k = 0; k < outputSets.size(); k++)
+    if (activation[k] > 0 && !outputSets[k].isSingleton())
+    {
+      active.push_back(k);
+      outputSets[k].getBreakpoints(cuts);
+      outputSets[k].getLevelCrossings(activation[k], cuts);
+    }
+  if (active.empty() || !(lo < hi))
+    return result;
+
+  for (double &cut : cuts)
+    cut = min(max(cut, lo), hi);
+  sort(cuts.begin(), cuts.end());
+  cuts.erase(unique(cuts.begin(), cuts.end()), cuts.end());
+
+  // Piece of the universe with the aggregated output at its ends, its middle
+  // and its quarters
+  struct Piece
+  {
+    double a, b;
+    double fa, fq1, fm, fq3, fb;
+    double area, moment;   // Simpson's rule on the two halves
+    double dArea, dMoment; // Difference with Simpson's rule on the whole
+  };
+  auto f = [&](double x)
+  {
+    result.samples++;
+    return adaptiveMembership(outputSets, activation, active, x);
+  };
+  auto integrate = [](Piece &p)
+  {
+    double h = p.b - p.a, m = (p.a + p.b) / 2;
+    double q1 = p.a + h / 4, q3 = p.b - h / 4;
+    double area1 = h / 6 * (p.fa + 4 * p.fm + p.fb);
+    double moment1 = h / 6 * (p.a * p.fa + 4 * m * p.fm + p.b * p.fb);
+    p.area = h / 12 * (p.fa + 4 * p.fq1 + 2 * p.fm + 4 * p.fq3 + p.fb);
+    p.moment = h / 12 * (p.a * p.fa + 4 * q1 * p.fq1 + 2 * m * p.fm +
+                         4 * q3 * p.fq3 + p.b * p.fb);
+    p.dArea = p.area - area1;
+    p.dMoment = p.moment - moment1;
+  };
+
+  vector<Piece> pieces;
+  vector<double> ends(cuts.size());
+  for (size_t c = 0; c < cuts.size(); c++)
+    ends[c] = f(cuts[c]);
+  for (size_t c = 0; c + 1 < cuts.size(); c++)
+  {
+    Piece p;
+    p.a = cuts[c];
+    p.b = cuts[c + 1];
+    double h = p.b - p.a;
+    p.fa = ends[c];
+    p.fb = ends[c + 1];
+    p.fq1 = f(p.a + h / 4);
+    p.fm = f(p.a + h / 2);
+    p.fq3 = f(p.b - h / 4);
+    integrate(p);
+    pieces.push_back(p);
+  }
+
+  while (true)
+  {
+    double area = 0, moment = 0;
+    for (const Piece &p : pieces)
+    {
+      area += p.area;
+      moment += p.moment;
+    }
+    if (area <= 0)
+    {
+      result.crisp = (lo + hi) / 2;
+      return result;
+    }
+    result.crisp = moment / area;
+
+    // Centroid error of every piece: (dMoment - crisp * dArea) / area
+    vector<double> errors(pieces.size());
+    double total = 0;
+    for (size_t i = 0; i < pieces.size(); i++)
+    {
+      errors[i] = fabs(pieces[i].dMoment - result.crisp * pieces[i].dArea) / area;
+      total += errors[i];
+    }
+    result.errorEstimate = total;
+    if (total <= tolerance || result.samples + 4 > maxSamples)
+      return result;
+
+    // Split the pieces above their share of the tolerance
+    vector<Piece> next;
+    double share = tolerance / pieces.size();
+    for (size_t i = 0; i < pieces.size(); i++)
+    {
+      const Piece &p = pieces[i];
+      double m = (p.a + p.b) / 2;
+      if (errors[i] <= share || result.samples + 4 > maxSamples || !(p.a < m && m < p.b))
+      {
+        next.push_back(p);
+        continue;
+      }
+
+      double h = (p.b - p.a) / 2;
+      Piece left = {p.a, m, p.fa, f(p.a + h / 4), p.fq1, f(m - h / 4), p.fm, 0, 0, 0, 0};
+      Piece right = {m, p.b, p.fm, f(m + h / 4), p.fq3, f(p.b - h / 4), p.fb, 0, 0, 0, 0};
+      integrate(left);
+      integrate(right);
+      next.push_back(left);
+      next.push_back(right);
+    }
+    if (next.size() == pieces.size())
+      return result; // No piece can be split any further
+    pieces.swap(next);
+  }
+}
+
+// Function to compute the adaptive centroid from the activations of the
+// output sets by name
+// Sets missing from outputValues are inactive
+AdaptiveCentroid defuzzifyAdaptive(const vector<OutputFuzzySet> &outputSets,
+                                   const map<string, double> &outputValues,
+                                   double tolerance, size_t maxSamples = 100000)
+{
+  vector<double> activation(outputSets.size(), 0);
+  for (size_t k = 0; k < outputSets.size(); k++)
+  {
+    auto found = outputValues.find(outputSets[k].getName());
+    if (found != outputValues.end())
+      activation[k] = found->second;
+  }
+  return defuzzifyAdaptive(outputSets, activation.data(), tolerance, maxSamples);
+}
+
+// Crisp outputs that a Defuzzifier computes in a single sweep
+struct DefuzzifiedOutputs
+{
+  double centroid;          // Center of the area
+  double bisector;          // Point that splits the area in two halves
+  double meanOfMaximum;     // Mean of the points with the largest degree
+  double smallestOfMaximum; // Smallest point with the largest degree
+  double largestOfMaximum;  // Largest point with the largest degree
+};
+
+// Class computing several defuzzifications of the aggregated output at once
+// The output sets are sampled once at DEFUZZ_SAMPLES points, like in
+// defuzzifyCentroid, and every request makes one sweep over the samples.
+// The sweep aggregates the clipped sets with vector min/max and feeds every
+// sample to the running area prefix, the centroid sums and the tracking of
+// the maximum degree and of its first and last positions
+// Models whose output sets are all singletons use the singleton positions
+// instead of samples
+class Defuzzifier
+{
+private:
+  vector<OutputFuzzySet> outputs; // Output sets, in activation order
+  vector<double> sampleX;         // Point of every sample
+  vector<double> shapes;          // Membership of every output set at every sample
+  vector<double> prefix;          // Area up to every sample of the last sweep
+  vector<double> aggregated;      // Aggregated output of the last sweep
+  vector<size_t> byPosition;      // Singleton sets sorted by position
+  bool singletons;                // All output sets are singletons
+  double lo, hi;                  // Universe of the output sets
+  ReductionMode mode;             // How the centroid sums are taken
+
+  // Method to defuzzify singleton output sets
+  // The bisector is the weighted median of the positions
+  DefuzzifiedOutputs defuzzifySingletonSets(const double *activation) const
+  {
+    double middle = (lo + hi) / 2;
+    DefuzzifiedOutputs result = {middle, middle, middle, middle, middle};
+
+    double area;
+    result.centroid = defuzzifySingletons(outputs, activation, &area, mode);
+    if (area <= 0)
+      return result;
+
+    double peak = 0, running = 0, peakSum = 0;
+    size_t peakCount = 0;
+    bool bisected = false;
+    for (size_t k : byPosition)
+    {
+      double a = activation[k];
+      double position = outputs[k].getPosition();
+      running += a;
+      if (!bisected && running >= area / 2)
+      {
+        result.bisector = position;
+        bisected = true;
+      }
+      if (a > peak)
+      {
+        peak = a;
+        result.smallestOfMaximum = result.largestOfMaximum = position;
+        peakSum = position;
+        peakCount = 1;
+      }
+      else if (a == peak && a > 0)
+      {
+        result.largestOfMaximum = position;
+        peakSum += position;
+        peakCount++;
+      }
+    }
+    result.meanOfMaximum = peakSum / peakCount;
+    return result;
+  }
+
+public:
+  // Constructor of the class
+  // Samples the output sets over their universe
+  Defuzzifier(const vector<OutputFuzzySet> &outputSets,
+              ReductionMode reductionMode = FAST_REDUCTION)
+      : outputs(outputSets), singletons(allSingletons(outputSets)), mode(reductionMode)
+  {
+    outputUniverse(outputSets, lo, hi);
+    if (singletons)
+    {
+      lo = HUGE_VAL;
+      hi = -HUGE_VAL;
+      for (size_t k = 0; k < outputSets.size(); k++)
+      {
+        byPosition.push_back(k);
+        lo = min(lo, outputSets[k].getPosition());
+        hi = max(hi, outputSets[k].getPosition());
+      }
+      if (outputSets.empty())
+        lo = hi = 0;
+      sort(byPosition.begin(), byPosition.end(), [&](size_t a, size_t b)
+           { return outputSets[a].getPosition() < outputSets[b].getPosition(); });
+      return;
+    }
+
+    double step = (hi - lo) / (DEFUZZ_SAMPLES - 1);
+    for (int i = 0; i < DEFUZZ_SAMPLES; i++)
+      sampleX.push_back(samplePoint(lo, step, i));
+
+    // Singletons mixed with other sets have no area
+    shapes.assign(outputSets.size() * DEFUZZ_SAMPLES, 0);
+    for (size_t k = 0; k < outputSets.size(); k++)
+      for (int i = 0; i < DEFUZZ_SAMPLES && !outputSets[k].isSingleton(); i++)
+        shapes[k * DEFUZZ_SAMPLES + i] = outputSets[k].eval(sampleX[i]);
+    prefix.resize(DEFUZZ_SAMPLES);
+    aggregated.resize(DEFUZZ_SAMPLES);
+  }
+
+  // Method to compute all the defuzzifications of the aggregated output
+  // activation[k] is the activation of the k-th output set
+  // Every value is the middle of the universe if no output set is active
+  DefuzzifiedOutputs defuzzify(const double *activation)
+  {
+    if (singletons)
+      return defuzzifySingletonSets(activation);
+
+    double middle = (lo + hi) / 2;
+    DefuzzifiedOutputs result = {middle, middle, middle, middle, middle};
+
+    // Skip the inactive output sets
+    vector<size_t> active;
+    for (size_t k = 0; k < outputs.size(); k++)
+      if (activation[k] > 0 && !outputs[k].isSingleton())
+        active.push_back(k);
+    if (active.empty())
+      return result;
+
+    double area = 0, weighted = 0, peak = 0, peakSum = 0;
+    size_t first = 0, last = 0, peakCount = 0;
+
+    // Method to feed one aggregated sample to all the accumulators
+    auto track = [&](size_t i, double mu)
+    {
+      aggregated[i] = mu;
+      area += mu;
+      prefix[i] = area;
+      weighted += sampleX[i] * mu;
+      if (mu > peak)
+      {
+        peak = mu;
+        first = last = i;
+        peakSum = sampleX[i];
+        peakCount = 1;
+      }
+      else if (mu == peak && mu > 0)
+      {
+        last = i;
+        peakSum += sampleX[i];
+        peakCount++;
+      }
+    };
+
+    size_t i = 0;
+#ifdef LANE_LOAD
+    // Aggregate LANE_WIDTH samples at a time
+    double block[LANE_WIDTH];
+    for (; i + LANE_WIDTH <= (size_t)DEFUZZ_SAMPLES; i += LANE_WIDTH)
+    {
+      LaneVector mu = LANE_ZERO();
+      for (size_t k : active)
+        mu = LANE_MAX(mu, LANE_MIN(LANE_SET1(activation[k]),
+                                   LANE_LOAD(&shapes[k * DEFUZZ_SAMPLES + i])));
+      LANE_STORE(block, mu);
+      for (size_t l = 0; l < LANE_WIDTH; l++)
+        track(i + l, block[l]);
+    }
+#endif
+    // Remaining samples, or all of them without SIMD
+    for (; i < (size_t)DEFUZZ_SAMPLES; i++)
+    {
+      double mu = 0;
+      for (size_t k : active)
+        mu = fOr(mu, fAnd(activation[k], shapes[k * DEFUZZ_SAMPLES + i]));
+      track(i, mu);
+    }
+
+    if (area <= 0)
+      return result;
+
+    if (mode == DETERMINISTIC_REDUCTION)
+      result.centroid = reproducibleDot(sampleX.data(), aggregated.data(), DEFUZZ_SAMPLES) /
+                        reproducibleSum(aggregated.data(), DEFUZZ_SAMPLES);
+    else
+      result.centroid = weighted / area;
+    result.bisector = sampleX[lower_bound(prefix.begin(), prefix.end(), area / 2) - prefix.begin()];
+    result.meanOfMaximum = peakSum / peakCount;
+    result.smallestOfMaximum = sampleX[first];
+    result.largestOfMaximum = sampleX[last];
+    return result;
+  }
+
+  // Method to compute all the defuzzifications from the activations of the
+  // output sets by name
+  // Sets missing from outputValues are inactive
+  DefuzzifiedOutputs defuzzify(const map<string, double> &outputValues)
+  {
+    vector<double> activation(outputs.size(), 0);
+    for (size_t k = 0; k < outputs.size(); k++)
+    {
+      auto found = outputValues.find(outputs[k].getName());
+      if (found != outputValues.end())
+        activation[k] = found->second;
+    }
+    return defuzzify(activation.data());
+  }
+};
+
+// Structure to hold the result of an approximate inference
+struct ApproximateResult
+{
+  double crisp;       // Crisp output computed from the kept rules
+  double errorBound;  // Bound on |crisp - centroid of the exact inference|
+  size_t keptRules;   // Rules used in the aggregation
+  size_t prunedRules; // Rules dropped before the aggregation
+};
+
+// Function to perform Mamdani inference keeping only the strongest rules
+// Rules whose firing strength is below epsilon are dropped and, if topK is
+// not 0, only the topK strongest remaining rules are kept. The kept rules
+// are aggregated and defuzzified with defuzzifyCentroid.
+//
+// The bound follows from the aggregation being a max: pruning lowers the
+// activation of a set k from a_k to a'_k, so each aggregated sample drops by
+// at most d_k = a_k - a'_k, and only inside the support of set k. Adding
+// the missing area E = sum(d_k * samples in support k) back to the kept area
+// A' moves the centroid toward a point of the pruned supports [L, R] by a
+// fraction of at most E / (A' + E), so
+//   |crisp - exact| <= E / (A' + E) * max(|crisp - L|, |R - crisp|)
+// where exact is the centroid defuzzifyCentroid gives without pruning
+ApproximateResult inferApproximate(const Rules &rules,
+                                   const map<string, double> &inputMembershipValues,
+                                   const vector<OutputFuzzySet> &outputSets,
+                                   double epsilon, size_t topK = 0)
+{
+  vector<pair<double, unsigned>> firings;
+  rules.fireRules(inputMembershipValues, firings);
+  const vector<string> &outputNames = rules.getOutputNames();
+
+  // Keep the topK strongest rules first
+  size_t kept = firings.size();
+  if (topK > 0 && topK < kept)
+  {
+    nth_element(firings.begin(), firings.begin() + topK, firings.end(),
+                [](const pair<double, unsigned> &a, const pair<double, unsigned> &b)
+                { return a.first > b.first; });
+    kept = topK;
+  }
+
+  // Aggregate the kept rules and remember the strongest dropped rule of
+  // every set
+  vector<double> keptDegrees(outputNames.size(), 0);
+  vector<double> droppedDegrees(outputNames.size(), 0);
+  ApproximateResult result = {0, 0, 0, 0};
+  for (size_t r = 0; r < firings.size(); r++)
+  {
+    double strength = firings[r].first;
+    unsigned output = firings[r].second;
+    if (r < kept && strength >= epsilon)
+    {
+      keptDegrees[output] = fOr(keptDegrees[output], strength);
+      result.keptRules++;
+    }
+    else
+    {
+      droppedDegrees[output] = fOr(droppedDegrees[output], strength);
+      result.prunedRules++;
+    }
+  }
+  result.prunedRules += rules.size() - firings.size();
+
+  map<string, double> outputValues;
+  for (size_t k = 0; k < outputNames.size(); k++)
+    outputValues[outputNames[k]] = keptDegrees[k];
+
+  double keptArea;
+  result.crisp = defuzzifyCentroid(outputSets, outputValues, &keptArea);
+
+  // Area that the pruned rules could add, and the hull of where it lies
+  double lo, hi;
+  outputUniverse(outputSets, lo, hi);
+  double step = (hi - lo) / (DEFUZZ_SAMPLES - 1);
+  bool singletons = allSingletons(outputSets);
+  double missingArea = 0, hullLo = HUGE_VAL, hullHi = -HUGE_VAL;
+  for (const auto &outputSet : outputSets)
+  {
+    auto found = find(outputNames.begin(), outputNames.end(), outputSet.getName());
+    if (found == outputNames.end())
+      continue;
+
+    size_t k = found - outputNames.begin();
+    double drop = droppedDegrees[k] - keptDegrees[k];
+    if (drop <= 0)
+      continue; // Pruning did not change the activation of this set
+
+    double supportLo, supportHi;
+    outputSet.getSupport(supportLo, supportHi);
+    supportLo = max(supportLo, lo);
+    supportHi = min(supportHi, hi);
+    if (singletons)
+    {
+      // The area of a singleton is its activation
+      missingArea += drop;
+    }
+    else
+    {
+      if (supportLo > supportHi || step <= 0 || outputSet.isSingleton())
+        continue;
+
+      // Number of samples that fall inside the support
+      double first = ceil((supportLo - lo) / step);
+      double last = floor((supportHi - lo) / step);
+      missingArea += drop * max(0.0, last - first + 1);
+    }
+    hullLo = min(hullLo, supportLo);
+    hullHi = max(hullHi, supportHi);
+  }
+
+  if (missingArea > 0)
+    result.errorBound = missingArea / (keptArea + missingArea) *
+                        max(fabs(result.crisp - hullLo), fabs(hullHi - result.crisp));
+
+  return result;
+}
+
+/******* Linguistic Variables *******/
+// Structure describing a linguistic variable declared in a fuzzy set file
+struct LinguisticVariable
+{
+  string name;            // Name of the variable, e.g. "Service"
+  bool output = false;    // Whether it is an output variable
+  double low = -HUGE_VAL; // Lower limit of its universe of discourse
+  double high = HUGE_VAL; // Upper limit of its universe of discourse
+  vector<string> terms;   // Names of its fuzzy sets
+};
+
+// Function to get the variable of a fuzzy set
+// A set belongs to variable V if it is named V or starts with "V_"
+// Returns the index of the variable in variableNames, or -1 if none matches
+int variableOf(const string &setName, const vector<string> &variableNames)
+{
+  for (size_t v = 0; v < variableNames.size(); v++)
+  {
+    const string &name = variableNames[v];
+    if (setName.compare(0, name.size(), name) == 0 &&
+        (setName.size() == name.size() || setName[name.size()] == '_'))
+      return v;
+  }
+  return -1;
+}
+
+// Function to get the variable of a fuzzy set
+// Declared sets belong to the variable with their declared name, other sets
+// are matched by name prefix
+// Returns the index of the variable in variableNames, or -1 if none matches
+int variableOf(const FuzzySet &set, const vector<string> &variableNames)
+{
+  if (set.getVariable() < 0)
+    return variableOf(set.getName(), variableNames);
+  for (size_t v = 0; v < variableNames.size(); v++)
+    if (variableNames[v] == set.getVariableName())
+      return v;
+  return -1;
+}
+
+// Function to get the crisp input that feeds an undeclared input fuzzy set
+// Sets about the service or waiting time use input 0 and sets about the
+// food or price use input 1
+// Returns -1 if the set does not belong to any input
+int inputIndexOf(const string &setName)
+{
+  if (setName.find("Service") != string::npos ||
+      setName.find("waiting_time") != string::npos)
+    return 0;
+  if (setName.find("Food") != string::npos ||
+      setName.find("price") != string::npos)
+    return 1;
+  return -1;
+}
+
+// Function to get the crisp input that feeds an input fuzzy set
+// Declared sets use the index of their variable, so inputs[i] feeds the
+// terms of the i-th declared input variable. Files without declarations
+// fall back to the set names
+int inputIndexOf(const InputFuzzySet &set)
+{
+  return set.getVariable() >= 0 ? set.getVariable() : inputIndexOf(set.getName());
+}
+
+// Function to get the number of crisp inputs of a model
+// Files that declare their input variables have one input per variable
+// (up to the last one with fuzzy sets); files without declarations have
+// the two inputs inputIndexOf knows about
+size_t inputCountOf(const vector<InputFuzzySet> &inputSets)
+{
+  bool declared = false;
+  int last = -1;
+  for (const auto &inputSet : inputSets)
+  {
+    declared = declared || inputSet.getVariable() >= 0;
+    last = max(last, inputIndexOf(inputSet));
+  }
+  return declared ? (size_t)(last + 1) : 2;
+}
+
+/******* Flat Rule Bases *******/
+// Structure holding the rules compiled into flat arrays indexed by term,
+// rule and output set, for the engines that run many inferences
+// Output indices follow the order of the output sets given to compile, so
+// activations can be defuzzified directly. Consequents without an output
+// set are appended after them. Terms are sorted by input, so the terms of
+// input i are the range [inputTermStart[i], inputTermStart[i + 1]) and
+// fuzzification does no lookup per term
+struct FlatRuleBase
+{
+  size_t inputCount = 0;            // Number of crisp inputs
+  vector<string> termNames;         // Name of every term
+  vector<InputFuzzySet> termSets;   // Fuzzy set of every term
+  vector<int> termInput;            // Input feeding every term (-1 none)
+  vector<size_t> inputTermStart;    // First term of every input
+  vector<string> outputNames;       // Name of every output set
+  vector<size_t> ruleStart;         // First antecedent of every rule
+  vector<unsigned> ruleTerms;       // Antecedent terms of all rules
+  vector<RuleOp> ruleOps;           // Connective before every antecedent
+  vector<unsigned> ruleOutput;      // Output set of every rule
+
+  // Method to compile the rules against the input and output fuzzy sets
+  // Inputs are routed to the terms with inputIndexOf, or by variable name
+  // with variableOf when inputNames gives the name of every input. The
+  // routing is resolved here, once. An input count of 0 takes the count
+  // from inputCountOf(inputSets); terms routed past the last input are
+  // reported and keep degree 0
+  void compile(const vector<InputFuzzySet> &inputSets, const Rules &rules,
+               const vector<OutputFuzzySet> &outputSets, size_t inputs,
+               const vector<string> &inputNames = vector<string>())
+  {
+    *this = FlatRuleBase();
+    inputCount = inputs > 0 ? inputs : inputCountOf(inputSets);
+
+    map<string, unsigned> termIndex, outputIndex;
+    for (const auto &outputSet : outputSets)
+    {
+      outputIndex[outputSet.getName()] = outputNames.size();
+      outputNames.push_back(outputSet.getName());
+    }
+
+    rules.forEachRule(
+        [&](const vector<string> &terms, const vector<RuleOp> &ops,
+            const string &consequent)
+        {
+          ruleStart.push_back(ruleTerms.size());
+          for (size_t a = 0; a < terms.size(); a++)
+          {
+            auto found = termIndex.find(terms[a]);
+            if (found == termIndex.end())
+            {
+              found = termIndex.insert(make_pair(terms[a], (unsigned)termNames.size())).first;
+              termNames.push_back(terms[a]);
+            }
+            ruleTerms.push_back(found->second);
+            ruleOps.push_back(a == 0 ? AND_OP : ops[a - 1]);
+          }
+
+          auto found = outputIndex.find(consequent);
+          if (found == outputIndex.end())
+          {
+            found = outputIndex.insert(make_pair(consequent, (unsigned)outputNames.size())).first;
+            outputNames.push_back(consequent);
+          }
+          ruleOutput.push_back(found->second);
+        });
+    ruleStart.push_back(ruleTerms.size());
+
+    // Attach the fuzzy set and the input of every term
+    // Terms without a fuzzy set keep degree 0
+    termSets.assign(termNames.size(), InputFuzzySet(""));
+    termInput.assign(termNames.size(), -1);
+    for (const auto &inputSet : inputSets)
+    {
+      auto found = termIndex.find(inputSet.getName());
+      if (found == termIndex.end())
+        continue;
+
+      termSets[found->second] = inputSet;
+      int input = inputNames.empty() ? inputIndexOf(inputSet)
+                                     : variableOf(inputSet, inputNames);
+      if (input >= 0 && (size_t)input < inputCount)
+        termInput[found->second] = input;
+      else if (input >= 0)
+        std::cerr << "Warning: term " << inputSet.getName() << " reads input " << input
+                  << " but the model has " << inputCount << " inputs" << std::endl;
+    }
+
+    // Renumber the terms by input, keeping their order within an input
+    // Terms without input go last
+    vector<unsigned> order(termNames.size());
+    for (size_t t = 0; t < order.size(); t++)
+      order[t] = t;
+    stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b)
+                { return (size_t)termInput[a] < (size_t)termInput[b]; });
+
+    vector<unsigned> renumbered(order.size());
+    vector<string> sortedNames;
+    vector<InputFuzzySet> sortedSets;
+    vector<int> sortedInputs;
+    for (size_t t = 0; t < order.size(); t++)
+    {
+      renumbered[order[t]] = t;
+      sortedNames.push_back(termNames[order[t]]);
+      sortedSets.push_back(termSets[order[t]]);
+      sortedInputs.push_back(termInput[order[t]]);
+    }
+    termNames.swap(sortedNames);
+    termSets.swap(sortedSets);
+    termInput.swap(sortedInputs);
+    for (auto &term : ruleTerms)
+      term = renumbered[term];
+
+    inputTermStart.assign(inputCount + 1, 0);
+    for (size_t t = 0; t < termInput.size(); t++)
+      if (termInput[t] >= 0)
+        inputTermStart[termInput[t] + 1]++;
+    for (size_t i = 0; i < inputCount; i++)
+      inputTermStart[i + 1] += inputTermStart[i];
+  }
+
+  // Method to get the number of rules
+  size_t ruleCount() const { return ruleOutput.size(); }
+
+  // Method to compute the membership degree of every term for one row of
+  // crisp inputs
+  void fuzzify(const double *inputs, double *termDegrees) const
+  {
+    for (size_t i = 0; i < inputCount; i++)
+      for (size_t t = inputTermStart[i]; t < inputTermStart[i + 1]; t++)
+        termDegrees[t] = termSets[t].eval(inputs[i]);
+    fill(termDegrees + inputTermStart[inputCount], termDegrees + termSets.size(), 0.0);
+  }
+
+  // Method to compute the firing strength of a rule
+  // Connectives are applied from left to right like in Rules::inferMamdani
+  double evaluateRule(size_t r, const double *termDegrees) const
+  {
+    double accum = termDegrees[ruleTerms[ruleStart[r]]];
+    for (size_t a = ruleStart[r] + 1; a < ruleStart[r + 1]; a++)
+    {
+      if (ruleOps[a] == AND_OP)
+        accum = fAnd(termDegrees[ruleTerms[a]], accum);
+      else
+        accum = fOr(termDegrees[ruleTerms[a]], accum);
+    }
+    return accum;
+  }
+
+  // Method to perform Mamdani inference with maximum aggregation
+  // Stores the activation of every output set in outputDegrees
+  void infer(const double *termDegrees, double *outputDegrees) const
+  {
+    fill(outputDegrees, outputDegrees + outputNames.size(), 0.0);
+    for (size_t r = 0; r < ruleOutput.size(); r++)
+      outputDegrees[ruleOutput[r]] =
+          fOr(outputDegrees[ruleOutput[r]], evaluateRule(r, termDegrees));
+  }
+
+  // Method to fuzzify one row of inputs and fire the rules with min/max
+  // connectives and maximum aggregation, for degrees of any ordered type
+  // (float, double or fixed point). degreeOf(t, x) gives the degree of
+  // term t at input x; terms without input get degree 0
+  template <class Degree, class Input, class DegreeOf>
+  void fireMinMax(const Input *inputs, DegreeOf degreeOf, Degree *termDegrees,
+                  Degree *outputDegrees) const
+  {
+    // Fuzzification over the term range of every input
+    for (size_t i = 0; i < inputCount; i++)
+      for (size_t t = inputTermStart[i]; t < inputTermStart[i + 1]; t++)
+        termDegrees[t] = degreeOf(t, inputs[i]);
+    fill(termDegrees + inputTermStart[inputCount], termDegrees + termSets.size(), Degree(0));
+
+    // Rules with min/max
+    fill(outputDegrees, outputDegrees + outputNames.size(), Degree(0));
+    for (size_t r = 0; r < ruleOutput.size(); r++)
+    {
+      Degree accum = termDegrees[ruleTerms[ruleStart[r]]];
+      for (size_t a = ruleStart[r] + 1; a < ruleStart[r + 1]; a++)
+        accum = ruleOps[a] == AND_OP ? min(accum, termDegrees[ruleTerms[a]])
+                                     : max(accum, termDegrees[ruleTerms[a]]);
+      outputDegrees[ruleOutput[r]] = max(outputDegrees[ruleOutput[r]], accum);
+    }
+  }
+};
+
+/******* Membership Tables *******/
+// Function to convert a membership degree to a table entry
+// uint16_t entries hold the degree scaled by 65535 and rounded
+template <class Storage>
+Storage toTableEntry(double degree);
+
+template <>
+inline uint16_t toTableEntry<uint16_t>(double degree)
+{
+  return (uint16_t)lround(degree * 65535);
+}
+
+template <>
+inline float toTableEntry<float>(double degree)
+{
+  return (float)degree;
+}
+
+// Function to convert a table entry back to a membership degree
+inline double fromTableEntry(uint16_t entry) { return entry * (1.0 / 65535); }
+inline double fromTableEntry(float entry) { return entry; }
+
+// Class to fuzzify a quantized input with one indexed load
+// The memberships of the terms of a variable are precomputed at every
+// point low + i * step of its universe. A row holds the index of the first
+// non-zero term followed by the degrees of the next width terms, where
+// width is the widest run of non-zero terms over the universe (2 for a
+// strong partition). Inputs outside the universe are clamped to it
+template <class Storage>
+class MembershipTable
+{
+private:
+  double low = 0;       // First point of the table
+  double step = 1;      // Distance between two points
+  double inverseStep = 1; // Inverse of the step
+  size_t rowCount = 0;  // Number of points
+  size_t termCount = 0; // Number of terms of the variable
+  size_t width = 0;     // Degrees stored per row
+  vector<Storage> rows; // Rows of width + 1 entries
+
+  // Method to get the position of x in rows, clamped to the table
+  double positionOf(double x) const
+  {
+    return min(max((x - low) * inverseStep, 0.0), (double)(rowCount - 1));
+  }
+
+  // Method to add the degrees of a row, scaled by weight, to degrees
+  void addRow(size_t row, double weight, double *degrees) const
+  {
+    const Storage *entry = &rows[row * (width + 1)];
+    double *target = degrees + (size_t)entry[0];
+    for (size_t k = 0; k < width; k++)
+      target[k] += weight * fromTableEntry(entry[1 + k]);
+  }
+
+public:
+  MembershipTable() {}
+
+  // Constructor that samples the terms over [lowLimit, highLimit]
+  MembershipTable(const InputFuzzySet *terms, size_t count, double lowLimit,
+                  double highLimit, double tableStep)
+      : low(lowLimit), step(tableStep), inverseStep(1 / tableStep), termCount(count)
+  {
+    rowCount = (size_t)floor((highLimit - lowLimit) / step + 0.5) + 1;
+
+    // Non-zero terms of every point, and the widest run of them
+    vector<size_t> first(rowCount, 0);
+    vector<double> degrees(rowCount * count);
+    for (size_t i = 0; i < rowCount; i++)
+    {
+      size_t last = 0;
+      bool any = false;
+      for (size_t t = 0; t < count; t++)
+      {
+        degrees[i * count + t] = terms[t].eval(low + i * step);
+        if (toTableEntry<Storage>(degrees[i * count + t]) == Storage(0))
+          continue;
+        if (!any)
+          first[i] = t;
+        last = t;
+        any = true;
+      }
+      if (any)
+        width = max(width, last - first[i] + 1);
+    }
+
+    // Runs near the last term start earlier, so every row holds width
+    // existing terms
+    rows.assign(rowCount * (width + 1), Storage(0));
+    for (size_t i = 0; i < rowCount; i++)
+    {
+      Storage *entry = &rows[i * (width + 1)];
+      first[i] = min(first[i], count - width);
+      entry[0] = (Storage)first[i];
+      for (size_t k = 0; k < width; k++)
+        entry[1 + k] = toTableEntry<Storage>(degrees[i * count + first[i] + k]);
+    }
+  }
+
+  // Method to get the number of degrees stored per row
+  size_t getWidth() const { return width; }
+
+  // Method to get the memory used by the table
+  size_t bytes() const { return rows.size() * sizeof(Storage); }
+
+  // Method to get the degrees of all the terms at the nearest point of x
+  void lookup(double x, double *degrees) const
+  {
+    const Storage *entry = &rows[(size_t)(positionOf(x) + 0.5) * (width + 1)];
+    size_t first = (size_t)entry[0];
+    fill(degrees, degrees + first, 0.0);
+    for (size_t k = 0; k < width; k++)
+      degrees[first + k] = fromTableEntry(entry[1 + k]);
+    fill(degrees + first + width, degrees + termCount, 0.0);
+  }
+
+  // Method to get the degrees of all the terms at x by linear
+  // interpolation between the two points around it
+  void interpolate(double x, double *degrees) const
+  {
+    double position = positionOf(x);
+    size_t row = (size_t)position;
+    double fraction = position - row;
+    fill(degrees, degrees + termCount, 0.0);
+    addRow(row, 1 - fraction, degrees);
+    if (fraction > 0)
+      addRow(row + 1, fraction, degrees);
+  }
+};
+
+// Class to fuzzify the inputs of a FlatRuleBase with membership tables
+// Inputs whose variable has a bounded universe get a table with their own
+// step; the other inputs are evaluated with their membership functions
+// Degrees are written in the term order of the model, like
+// FlatRuleBase::fuzzify. The model must outlive the fuzzifier
+template <class Storage>
+class TableFuzzifier
+{
+private:
+  const FlatRuleBase *model;              // Model whose terms are tabulated
+  vector<MembershipTable<Storage>> tables; // Table of every input
+  vector<char> tabulated;                 // Whether an input has a table
+  bool interpolating;                     // Interpolate between points
+
+public:
+  // Constructor of the class
+  // variables are the declared input variables in input order and steps
+  // the distance between the points of every table
+  TableFuzzifier(const FlatRuleBase &flatModel, const vector<LinguisticVariable> &variables,
+                 const vector<double> &steps, bool interpolate = false)
+      : model(&flatModel), tables(flatModel.inputCount),
+        tabulated(flatModel.inputCount, false), interpolating(interpolate)
+  {
+    for (size_t i = 0; i < model->inputCount && i < variables.size() && i < steps.size(); i++)
+    {
+      if (!isfinite(variables[i].low) || !isfinite(variables[i].high) || !(steps[i] > 0))
+        continue;
+      size_t first = model->inputTermStart[i];
+      tables[i] = MembershipTable<Storage>(&model->termSets[first],
+                                           model->inputTermStart[i + 1] - first,
+                                           variables[i].low, variables[i].high, steps[i]);
+      tabulated[i] = true;
+    }
+  }
+
+  // Method to get the memory used by the tables
+  size_t bytes() const
+  {
+    size_t total = 0;
+    for (const auto &table : tables)
+      total += table.bytes();
+    return total;
+  }
+
+  // Method to compute the membership degree of every term for one row of
+  // crisp inputs
+  void fuzzify(const double *inputs, double *termDegrees) const
+  {
+    for (size_t i = 0; i < model->inputCount; i++)
+    {
+      double *degrees = termDegrees + model->inputTermStart[i];
+      if (!tabulated[i])
+      {
+        for (size_t t = model->inputTermStart[i]; t < model->inputTermStart[i + 1]; t++)
+          termDegrees[t] = model->termSets[t].eval(inputs[i]);
+      }
+      else if (interpolating)
+        tables[i].interpolate(inputs[i], degrees);
+      else
+        tables[i].lookup(inputs[i], degrees);
+    }
+    fill(termDegrees + model->inputTermStart[model->inputCount],
+         termDegrees + model->termSets.size(), 0.0);
+  }
+};
+
+/******* Fixed-Point Inference *******/
+// Crisp values are fixed-point numbers with 16 fractional bits (Q16.16)
+typedef int32_t Fixed;
+const int FIXED_BITS = 16;
+
+// Membership degrees have 15 fractional bits (Q15): 1 is MEMBERSHIP_ONE
+const int32_t MEMBERSHIP_ONE = 1 << 15;
+
+// The Gaussian table holds exp(-s^2) for s in [0, 4) with 2^GAUSS_TABLE_BITS
+// entries per unit; beyond s = 4 the degree is below the Q15 resolution
+const int GAUSS_TABLE_BITS = 8;
+const size_t GAUSS_TABLE_SIZE = 4 << GAUSS_TABLE_BITS;
+
+// Function to convert a crisp value to Q16.16, saturating at the limits
+Fixed toFixed(double x)
+{
+  double scaled = x * (1 << FIXED_BITS);
+  if (scaled >= INT32_MAX)
+    return INT32_MAX;
+  if (scaled <= INT32_MIN)
+    return INT32_MIN;
+  return (Fixed)llround(scaled);
+}
+
+// Function to convert a Q16.16 value to a double
+double fromFixed(Fixed x) { return x / (double)(1 << FIXED_BITS); }
+
+// Function to get the table of exp(-s^2) in Q15
+// Has one extra entry so every interval can be interpolated
+const vector<int32_t> &gaussTable()
+{
+  static const vector<int32_t> table = []()
+  {
+    vector<int32_t> entries(GAUSS_TABLE_SIZE + 1);
+    for (size_t i = 0; i <= GAUSS_TABLE_SIZE; i++)
+    {
+      double s = (double)i / (1 << GAUSS_TABLE_BITS);
+      entries[i] = (int32_t)lround(exp(-s * s) * MEMBERSHIP_ONE);
+    }
+    return entries;
+  }();
+  return table;
+}
+
+// Class to evaluate a membership function with integer arithmetic only
+// Parameters are stored in Q16.16 and the slopes of the linear pieces as
+// reciprocals precomputed at construction, so an evaluation is a few
+// comparisons and one multiplication. Gaussians use gaussTable
+class FixedMembership
+{
+private:
+  MFType type = TRIANG; // Type of membership function
+  Fixed points[4] = {}; // Parameters in Q16.16
+  int64_t slopes[2] = {}; // 2^47 / width of the rising and falling pieces
+  int64_t gaussReach = 0; // Q16.16 distance where a Gaussian leaves the table
+  size_t count = 0;     // Number of parameters
+
+  // Function to get the reciprocal of the width of a linear piece
+  static int64_t reciprocal(int64_t width)
+  {
+    return width > 0 ? ((int64_t(1) << 47) + width / 2) / width : 0;
+  }
+
+  // Function to get the degree at distance dx from the foot of a linear
+  // piece with the given reciprocal width
+  // dx never exceeds the width, so the product stays below 2^48
+  static int32_t ramp(int64_t dx, int64_t slope)
+  {
+    return (int32_t)min<int64_t>(MEMBERSHIP_ONE, (dx * slope + (int64_t(1) << 31)) >> 32);
+  }
+
+public:
+  FixedMembership() {}
+
+  // Constructor that converts a membership function to fixed point
+  FixedMembership(MFType mfType, const vector<double> &params)
+      : type(mfType), count(min(params.size(), (size_t)4))
+  {
+    for (size_t p = 0; p < count; p++)
+      points[p] = toFixed(params[p]);
+
+    if (type == TRIANG && count == 3)
+    {
+      slopes[0] = reciprocal((int64_t)points[1] - points[0]);
+      slopes[1] = reciprocal((int64_t)points[2] - points[1]);
+    }
+    else if (type == TRAP && count == 4)
+    {
+      slopes[0] = reciprocal((int64_t)points[1] - points[0]);
+      slopes[1] = reciprocal((int64_t)points[3] - points[2]);
+    }
+    else if (type == SAT && count == 2)
+      slopes[0] = reciprocal(llabs((int64_t)points[1] - points[0]));
+    else if (type == GAUSS && count == 2 && params[1] > 0)
+    {
+      // 2^32 / sqrt(2 * width) scales a Q16.16 distance to s in Q16. It is
+      // capped at 2^50, where any distance of one step is past the table
+      slopes[0] = llround(min(4294967296.0 / sqrt(2 * params[1]), 1125899906842624.0));
+      // s reaches 4, the end of the table, at distance 2^50 / slope
+      gaussReach = ((int64_t(4) << 48) + slopes[0] - 1) / slopes[0];
+    }
+  }
+
+  // Method to evaluate the membership degree of x in Q15
+  int32_t eval(Fixed x) const
+  {
+    switch (type)
+    {
+    case TRIANG:
+      if (count != 3 || x <= points[0] || x >= points[2])
+        return 0;
+      if (x <= points[1])
+        return ramp((int64_t)x - points[0], slopes[0]);
+      return ramp((int64_t)points[2] - x, slopes[1]);
+    case TRAP:
+      if (count != 4 || x <= points[0] || x >= points[3])
+        return 0;
+      if (x <= points[1])
+        return ramp((int64_t)x - points[0], slopes[0]);
+      if (x <= points[2])
+        return MEMBERSHIP_ONE;
+      return ramp((int64_t)points[3] - x, slopes[1]);
+    case SAT:
+      if (count != 2)
+        return 0;
+      // Saturated on the left like satmf when up < down, else on the right
+      if (points[0] < points[1])
+        return x <= points[0] ? MEMBERSHIP_ONE
+               : x >= points[1] ? 0 : ramp((int64_t)points[1] - x, slopes[0]);
+      return x >= points[0] ? MEMBERSHIP_ONE
+             : x <= points[1] ? 0 : ramp((int64_t)x - points[1], slopes[0]);
+    case GAUSS:
+    {
+      if (count != 2 || slopes[0] == 0)
+        return 0;
+      // s = |x - center| / sqrt(2 * width) in Q16, then a table lookup with
+      // linear interpolation. Distances past gaussReach are 0, which also
+      // keeps the product below 2^51
+      int64_t dx = llabs((int64_t)x - points[0]);
+      if (dx >= gaussReach)
+        return 0;
+      int64_t s = (dx * slopes[0]) >> 32;
+      int64_t index = s >> (FIXED_BITS - GAUSS_TABLE_BITS);
+      int64_t fraction = s & ((1 << (FIXED_BITS - GAUSS_TABLE_BITS)) - 1);
+      const vector<int32_t> &table = gaussTable();
+      return (int32_t)((table[index] * ((1 << (FIXED_BITS - GAUSS_TABLE_BITS)) - fraction) +
+                        table[index + 1] * fraction) >>
+                       (FIXED_BITS - GAUSS_TABLE_BITS));
+    }
+    case SINGLETON:
+      return count == 1 && x == points[0] ? MEMBERSHIP_ONE : 0;
+    }
+    return 0;
+  }
+};
+
+// Class to run Mamdani inference with integer arithmetic only
+// Inputs and outputs are Q16.16 and memberships Q15. Rules are evaluated
+// with integer min/max, and the centroid is taken over the same samples as
+// defuzzifyCentroid with the shapes of the output sets precomputed in Q15.
+// Singleton outputs use a weighted average like defuzzifySingletons
+class FixedPointEngine
+{
+private:
+  FlatRuleBase model;            // Rules compiled into flat arrays
+  vector<FixedMembership> terms; // Membership function of every term
+  size_t setCount;               // Number of output sets
+  bool singletons;               // Whether every output set is a singleton
+  vector<Fixed> positions;       // Position of every singleton
+  Fixed lo, hi;                  // Universe of the output
+  vector<int32_t> shapes;        // Degree of every output set at every sample
+  vector<int32_t> termDegrees;   // Degree of every term
+  vector<int32_t> activation;    // Activation of every output set
+  vector<int32_t> aggregated;    // Aggregated output at every sample
+
+public:
+  // Constructor that converts the model to fixed point
+  FixedPointEngine(const vector<InputFuzzySet> &inputSets, const Rules &rules,
+                   const vector<OutputFuzzySet> &outputSets, size_t inputCount = 0)
+      : setCount(outputSets.size()), singletons(allSingletons(outputSets))
+  {
+    model.compile(inputSets, rules, outputSets, inputCount);
+    terms.resize(model.termNames.size());
+    for (size_t t = 0; t < model.inputTermStart[model.inputCount]; t++)
+      terms[t] = FixedMembership(model.termSets[t].getType(), model.termSets[t].getParams());
+
+    double universeLo, universeHi;
+    outputUniverse(outputSets, universeLo, universeHi);
+    lo = toFixed(universeLo);
+    hi = toFixed(universeHi);
+
+    // Sample k of the universe is at lo + (hi - lo) * k / (DEFUZZ_SAMPLES - 1)
+    shapes.assign(setCount * DEFUZZ_SAMPLES, 0);
+    for (size_t k = 0; k < setCount; k++)
+    {
+      positions.push_back(outputSets[k].isSingleton() ? toFixed(outputSets[k].getPosition()) : 0);
+      if (singletons || outputSets[k].isSingleton())
+        continue;
+      FixedMembership shape(outputSets[k].getType(), outputSets[k].getParams());
+      for (int i = 0; i < DEFUZZ_SAMPLES; i++)
+        shapes[k * DEFUZZ_SAMPLES + i] =
+            shape.eval(lo + (Fixed)(((int64_t)hi - lo) * i / (DEFUZZ_SAMPLES - 1)));
+    }
+
+    termDegrees.resize(model.termNames.size());
+    activation.resize(model.outputNames.size());
+    aggregated.resize(DEFUZZ_SAMPLES);
+  }
+
+  // Method to infer the crisp output in Q16.16 from inputs in Q16.16
+  Fixed infer(const Fixed *inputs)
+  {
+    // Fuzzification and rules with integer min/max
+    model.fireMinMax(inputs, [&](size_t t, Fixed x)
+                     { return terms[t].eval(x); },
+                     termDegrees.data(), activation.data());
+
+    if (singletons)
+    {
+      int64_t numerator = 0, denominator = 0;
+      for (size_t k = 0; k < setCount; k++)
+      {
+        numerator += (int64_t)activation[k] * positions[k];
+        denominator += activation[k];
+      }
+      if (denominator == 0)
+        return setCount == 0 ? 0 : (Fixed)(((int64_t)lo + hi) / 2);
+      return (Fixed)(numerator / denominator);
+    }
+
+    // Aggregation of the clipped output sets
+    fill(aggregated.begin(), aggregated.end(), 0);
+    for (size_t k = 0; k < setCount; k++)
+    {
+      if (activation[k] == 0)
+        continue;
+      const int32_t *shape = &shapes[k * DEFUZZ_SAMPLES];
+      for (int i = 0; i < DEFUZZ_SAMPLES; i++)
+        aggregated[i] = max(aggregated[i], min(activation[k], shape[i]));
+    }
+
+    // Centroid as a fraction of the universe with 24 bits; the moment is
+    // below 2^35, so shifting it by 24 stays within 64 bits
+    int64_t moment = 0, area = 0;
+    for (int i = 0; i < DEFUZZ_SAMPLES; i++)
+    {
+      moment += (int64_t)aggregated[i] * i;
+      area += aggregated[i];
+    }
+    if (area == 0)
+      return (Fixed)(((int64_t)lo + hi) / 2);
+    int64_t fraction = (moment << 24) / (area * (DEFUZZ_SAMPLES - 1));
+    return (Fixed)(lo + ((((int64_t)hi - lo) * fraction + (int64_t(1) << 23)) >> 24));
+  }
+
+  // Method to infer the crisp output for a vector of crisp inputs
+  double infer(const vector<double> &inputs)
+  {
+    vector<Fixed> fixedInputs(model.inputCount, 0);
+    for (size_t i = 0; i < fixedInputs.size() && i < inputs.size(); i++)
+      fixedInputs[i] = toFixed(inputs[i]);
+    return fromFixed(infer(fixedInputs.data()));
+  }
+};
+
+/******* Mixed Precision *******/
+// Structure to store a membership degree in bfloat16: the upper 16 bits of
+// a float, rounded to nearest even. Degrees keep 8 significant bits
+struct BFloat16
+{
+  uint16_t bits = 0;
+
+  BFloat16() {}
+
+  explicit BFloat16(float value)
+  {
+    uint32_t word;
+    memcpy(&word, &value, sizeof(word));
+    bits = (uint16_t)((word + 0x7FFF + ((word >> 16) & 1)) >> 16);
+  }
+
+  operator float() const
+  {
+    uint32_t word = (uint32_t)bits << 16;
+    float value;
+    memcpy(&value, &word, sizeof(value));
+    return value;
+  }
+};
+
+// Samples summed in Scalar before their sums are added to the accumulator
+const size_t PRECISION_BLOCK = 64;
+
+// Class to run Mamdani inference in a chosen precision
+// Scalar is the type of the computations (double or float, a float vector
+// has twice the lanes), Storage the type of the sampled output-set shapes
+// (Scalar, or BFloat16 with float) and Accumulator the type of the
+// centroid sums. ScalarEngine<float, BFloat16, double> stores memberships
+// in 16 bits and accumulates the centroid in double; Scalar partial sums
+// never span more than PRECISION_BLOCK samples
+template <class Scalar, class Storage = Scalar, class Accumulator = Scalar>
+class ScalarEngine
+{
+private:
+  FlatRuleBase model;              // Rules compiled into flat arrays
+  vector<MFType> termTypes;        // Membership function of every term
+  vector<vector<Scalar>> termParams; // Parameters of every term
+  size_t setCount;                 // Number of output sets
+  bool singletons;                 // Whether every output set is a singleton
+  vector<Accumulator> positions;   // Position of every singleton
+  Accumulator lo, step;            // First sample and distance between samples
+  vector<Storage> shapes;          // Degree of every output set at every sample
+  vector<Scalar> sampleIndex;      // Index of every sample
+  vector<Scalar> termDegrees;      // Degree of every term
+  vector<Scalar> activation;       // Activation of every output set
+  vector<Scalar> aggregated;       // Aggregated output at every sample
+
+public:
+  // Constructor that converts the model to the chosen types
+  ScalarEngine(const vector<InputFuzzySet> &inputSets, const Rules &rules,
+               const vector<OutputFuzzySet> &outputSets, size_t inputCount = 0)
+      : setCount(outputSets.size()), singletons(allSingletons(outputSets))
+  {
+    model.compile(inputSets, rules, outputSets, inputCount);
+    termTypes.resize(model.termNames.size(), TRIANG);
+    termParams.resize(model.termNames.size());
+    for (size_t t = 0; t < model.inputTermStart[model.inputCount]; t++)
+    {
+      termTypes[t] = model.termSets[t].getType();
+      for (double p : model.termSets[t].getParams())
+        termParams[t].push_back((Scalar)p);
+    }
+
+    double universeLo, universeHi;
+    outputUniverse(outputSets, universeLo, universeHi);
+    lo = universeLo;
+    step = (universeHi - universeLo) / (DEFUZZ_SAMPLES - 1);
+
+    shapes.assign(setCount * DEFUZZ_SAMPLES, Storage(0));
+    for (size_t k = 0; k < setCount; k++)
+    {
+      positions.push_back(outputSets[k].isSingleton() ? outputSets[k].getPosition() : 0);
+      if (singletons || outputSets[k].isSingleton())
+        continue;
+      for (int i = 0; i < DEFUZZ_SAMPLES; i++)
+        shapes[k * DEFUZZ_SAMPLES + i] = Storage((Scalar)outputSets[k].eval(lo + i * step));
+    }
+
+    for (int i = 0; i < DEFUZZ_SAMPLES; i++)
+      sampleIndex.push_back((Scalar)i);
+    termDegrees.resize(model.termNames.size());
+    activation.resize(model.outputNames.size());
+    aggregated.resize(DEFUZZ_SAMPLES);
+  }
+
+  // Method to infer the crisp output of one row of crisp inputs
+  Accumulator infer(const Scalar *inputs)
+  {
+    // Fuzzification and rules with min/max
+    model.fireMinMax(inputs, [&](size_t t, Scalar x)
+                     { return membership(termTypes[t], termParams[t], x); },
+                     termDegrees.data(), activation.data());
+
+    if (singletons)
+    {
+      Accumulator numerator = 0, denominator = 0;
+      for (size_t k = 0; k < setCount; k++)
+      {
+        numerator += activation[k] * positions[k];
+        denominator += activation[k];
+      }
+      if (denominator <= 0)
+        return setCount == 0 ? 0 : lo + step * (DEFUZZ_SAMPLES - 1) / 2;
+      return numerator / denominator;
+    }
+
+    // Aggregation of the clipped output sets
+    fill(aggregated.begin(), aggregated.end(), Scalar(0));
+    for (size_t k = 0; k < setCount; k++)
+    {
+      if (activation[k] <= 0)
+        continue;
+      const Storage *shape = &shapes[k * DEFUZZ_SAMPLES];
+      size_t i = 0;
+#ifdef LANE_LOAD
+      typedef Lanes<Scalar> L;
+      typename L::Vector level = L::set1(activation[k]);
+      for (; i + L::WIDTH <= (size_t)DEFUZZ_SAMPLES; i += L::WIDTH)
+        L::store(&aggregated[i], L::max(L::load(&aggregated[i]), L::min(level, L::load(shape + i))));
+#endif
+      for (; i < (size_t)DEFUZZ_SAMPLES; i++)
+        aggregated[i] = max(aggregated[i], min(activation[k], (Scalar)shape[i]));
+    }
+
+    // Centroid lo + step * sum(i * mu) / sum(mu), with the sums of every
+    // block of samples added to the accumulators
+    Accumulator moment = 0, area = 0;
+    for (size_t block = 0; block < (size_t)DEFUZZ_SAMPLES; block += PRECISION_BLOCK)
+    {
+      size_t end = min(block + PRECISION_BLOCK, (size_t)DEFUZZ_SAMPLES);
+      size_t i = block;
+#ifdef LANE_LOAD
+      typedef Lanes<Scalar> L;
+      typename L::Vector blockMoment = L::zero(), blockArea = L::zero();
+      for (; i + L::WIDTH <= end; i += L::WIDTH)
+      {
+        typename L::Vector mu = L::load(&aggregated[i]);
+        blockArea = L::add(blockArea, mu);
+        blockMoment = L::add(blockMoment, L::mul(mu, L::load(&sampleIndex[i])));
+      }
+      Scalar laneMoment[L::WIDTH], laneArea[L::WIDTH];
+      L::store(laneMoment, blockMoment);
+      L::store(laneArea, blockArea);
+      for (size_t l = 0; l < L::WIDTH; l++)
+      {
+        moment += laneMoment[l];
+        area += laneArea[l];
+      }
+#endif
+      for (; i < end; i++)
+      {
+        moment += (Accumulator)(aggregated[i] * sampleIndex[i]);
+        area += aggregated[i];
+      }
+    }
+
+    if (area <= 0)
+      return lo + step * (DEFUZZ_SAMPLES - 1) / 2;
+    return lo + step * (moment / area);
+  }
+
+  // Method to infer the crisp output for a vector of crisp inputs
+  Accumulator infer(const vector<double> &inputs)
+  {
+    vector<Scalar> scalarInputs(model.inputCount, 0);
+    for (size_t i = 0; i < scalarInputs.size() && i < inputs.size(); i++)
+      scalarInputs[i] = (Scalar)inputs[i];
+    return infer(scalarInputs.data());
+  }
+};
+
+/******* Lazy Output Evaluation *******/
+// Class to infer only the output sets a caller asks for
+// Only the rules whose consequents are requested are evaluated, and a term
+// is fuzzified the first time one of those rules needs its degree
+class LazyInference
+{
+private:
+  FlatRuleBase model;                 // Rules compiled into flat arrays
+  vector<vector<size_t>> outputRules; // Rules feeding every output set
+  vector<double> termDegrees;         // Membership degree of every term
+  vector<unsigned> termStamp;         // Call in which every term was fuzzified
+  unsigned stamp;                     // Number of the current call
+  size_t lastEvaluations;             // Rules evaluated by the last call
+  size_t lastFuzzifications;          // Terms fuzzified by the last call
+
+  // Method to get the degree of a term, fuzzifying it on first use
+  double termDegree(unsigned t, const double *inputs)
+  {
+    if (termStamp[t] != stamp)
+    {
+      termStamp[t] = stamp;
+      termDegrees[t] = model.termInput[t] >= 0 ? model.termSets[t].eval(inputs[model.termInput[t]]) : 0;
+      lastFuzzifications++;
+    }
+    return termDegrees[t];
+  }
+
+  // Method to compute the firing strength of a rule
+  // Connectives are applied from left to right like in
+  // FlatRuleBase::evaluateRule. A term is not fuzzified when the connective
+  // already fixes the result (AND with 0, OR with 1)
+  double evaluateRule(size_t r, const double *inputs)
+  {
+    lastEvaluations++;
+    double accum = termDegree(model.ruleTerms[model.ruleStart[r]], inputs);
+    for (size_t a = model.ruleStart[r] + 1; a < model.ruleStart[r + 1]; a++)
+    {
+      if (model.ruleOps[a] == AND_OP)
+      {
+        if (accum > 0)
+          accum = fAnd(termDegree(model.ruleTerms[a], inputs), accum);
+      }
+      else if (accum < 1)
+        accum = fOr(termDegree(model.ruleTerms[a], inputs), accum);
+    }
+    return accum;
+  }
+
+  // Method to start a new call
+  void beginCall()
+  {
+    lastEvaluations = 0;
+    lastFuzzifications = 0;
+    if (++stamp == 0)
+    {
+      // The stamps wrapped around: forget every degree
+      fill(termStamp.begin(), termStamp.end(), 0);
+      stamp = 1;
+    }
+  }
+
+public:
+  // Constructor of the class
+  // Compiles the rules and indexes them by output set
+  LazyInference(const vector<InputFuzzySet> &inputSets, const Rules &rules,
+                const vector<OutputFuzzySet> &outputSets, size_t inputCount = 0)
+      : stamp(0), lastEvaluations(0), lastFuzzifications(0)
+  {
+    model.compile(inputSets, rules, outputSets, inputCount);
+    outputRules.resize(model.outputNames.size());
+    for (size_t r = 0; r < model.ruleCount(); r++)
+      outputRules[model.ruleOutput[r]].push_back(r);
+    termDegrees.resize(model.termNames.size());
+    termStamp.assign(model.termNames.size(), 0);
+  }
+
+  // Method to get the names of the output sets, in the order of the mask
+  // Output sets come first, in the order given to the constructor
+  const vector<string> &getOutputNames() const { return model.outputNames; }
+
+  // Method to get the number of rules evaluated by the last call
+  size_t getLastEvaluations() const { return lastEvaluations; }
+
+  // Method to get the number of terms fuzzified by the last call
+  size_t getLastFuzzifications() const { return lastFuzzifications; }
+
+  // Method to compute the activation of the requested output sets
+  // requested[k] selects the output set k of getOutputNames; missing
+  // entries are not requested. outputDegrees[k] receives the maximum
+  // strength of the rules of a requested set and 0 for the others
+  void infer(const double *inputs, const vector<bool> &requested, double *outputDegrees)
+  {
+    beginCall();
+    for (size_t k = 0; k < outputRules.size(); k++)
+    {
+      outputDegrees[k] = 0;
+      if (k >= requested.size() || !requested[k])
+        continue;
+      for (size_t r : outputRules[k])
+      {
+        outputDegrees[k] = fOr(outputDegrees[k], evaluateRule(r, inputs));
+        if (outputDegrees[k] >= 1)
+          break; // No rule can raise the activation any further
+      }
+    }
+  }
+
+  // Method to get the dominant output set without defuzzifying
+  // Only the output sets selected by requested are considered, or all of
+  // them if requested is empty
+  // Returns the index of the most activated set in getOutputNames (the
+  // first one on ties), or -1 if no rule fires
+  int inferLabel(const double *inputs, const vector<bool> &requested = vector<bool>())
+  {
+    vector<bool> all(outputRules.size(), true);
+    vector<double> outputDegrees(outputRules.size());
+    infer(inputs, requested.empty() ? all : requested, outputDegrees.data());
+
+    int label = -1;
+    double best = 0;
+    for (size_t k = 0; k < outputDegrees.size(); k++)
+      if (outputDegrees[k] > best)
+      {
+        best = outputDegrees[k];
+        label = k;
+      }
+    return label;
+  }
+};
+
+/******* Multi-Output Systems *******/
+// Structure describing an output variable of a fuzzy system
+struct OutputVariable
+{
+  string name;                 // Name of the variable, e.g. "Tip"
+  vector<OutputFuzzySet> sets; // Output sets of the variable
+};
+
+// Function to group the output sets by output variable
+// Sets that do not belong to any variable are skipped
+vector<OutputVariable> groupOutputSets(const vector<OutputFuzzySet> &outputSets,
+                                       const vector<string> &variableNames)
+{
+  vector<OutputVariable> variables(variableNames.size());
+  for (size_t v = 0; v < variableNames.size(); v++)
+    variables[v].name = variableNames[v];
+  for (const auto &outputSet : outputSets)
+  {
+    int v = variableOf(outputSet, variableNames);
+    if (v >= 0)
+      variables[v].sets.push_back(outputSet);
+  }
+  return variables;
+}
+
+// Class to infer several output variables from the same inputs
+// The inputs are fuzzified once and every distinct antecedent is evaluated
+// once into a firing-strength array. Every output variable then only adds
+// its consequents (max aggregation) and its defuzzification, so a new
+// output costs its consequent work
+class MultiOutputEngine
+{
+private:
+  FlatRuleBase model;                  // Rules compiled into flat arrays
+  vector<string> names;                // Name of every output variable
+  vector<size_t> variableStart;        // First output set of every variable
+  vector<Defuzzifier> defuzzifiers;    // Defuzzifier of every variable
+  vector<size_t> antecedentRule;       // A rule with every distinct antecedent
+  vector<unsigned> ruleAntecedent;     // Distinct antecedent of every rule
+  vector<double> termDegrees;          // Membership degree of every term
+  vector<double> strengths;            // Firing strength of every antecedent
+  vector<double> activation;           // Activation of every output set
+
+public:
+  // Constructor of the class
+  // Compiles the rules against the output sets of all the variables and
+  // finds the rules that share their antecedent
+  MultiOutputEngine(const vector<InputFuzzySet> &inputSets, const Rules &rules,
+                    const vector<OutputVariable> &variables, size_t inputCount = 0)
+  {
+    vector<OutputFuzzySet> outputSets;
+    for (const auto &variable : variables)
+    {
+      names.push_back(variable.name);
+      variableStart.push_back(outputSets.size());
+      outputSets.insert(outputSets.end(), variable.sets.begin(), variable.sets.end());
+      defuzzifiers.push_back(Defuzzifier(variable.sets));
+    }
+    variableStart.push_back(outputSets.size());
+    model.compile(inputSets, rules, outputSets, inputCount);
+
+    // Rules with the same terms and connectives share one antecedent
+    map<vector<unsigned>, unsigned> antecedentIndex;
+    for (size_t r = 0; r < model.ruleCount(); r++)
+    {
+      vector<unsigned> key;
+      for (size_t a = model.ruleStart[r]; a < model.ruleStart[r + 1]; a++)
+        key.push_back(model.ruleTerms[a] * 2 + model.ruleOps[a]);
+      auto found = antecedentIndex.find(key);
+      if (found == antecedentIndex.end())
+      {
+        found = antecedentIndex.insert(make_pair(key, (unsigned)antecedentRule.size())).first;
+        antecedentRule.push_back(r);
+      }
+      ruleAntecedent.push_back(found->second);
+    }
+
+    termDegrees.resize(model.termNames.size());
+    strengths.resize(antecedentRule.size());
+    activation.resize(model.outputNames.size());
+  }
+
+  // Method to get the number of output variables
+  size_t variableCount() const { return names.size(); }
+
+  // Method to get the name of an output variable
+  const string &variableName(size_t v) const { return names[v]; }
+
+  // Method to get the number of distinct antecedents evaluated per call
+  size_t antecedentCount() const { return antecedentRule.size(); }
+
+  // Method to infer the crisp value of every output variable
+  // crisp[v] receives the centroid of variable v
+  void infer(const double *inputs, double *crisp)
+  {
+    // Fuzzification and antecedents, shared by all the variables
+    model.fuzzify(inputs, termDegrees.data());
+    for (size_t a = 0; a < antecedentRule.size(); a++)
+      strengths[a] = model.evaluateRule(antecedentRule[a], termDegrees.data());
+
+    // Consequents of every variable over the same strengths
+    fill(activation.begin(), activation.end(), 0.0);
+    for (size_t r = 0; r < ruleAntecedent.size(); r++)
+      activation[model.ruleOutput[r]] =
+          fOr(activation[model.ruleOutput[r]], strengths[ruleAntecedent[r]]);
+
+    for (size_t v = 0; v < names.size(); v++)
+      crisp[v] = defuzzifiers[v].defuzzify(&activation[variableStart[v]]).centroid;
+  }
+
+  // Method to infer the crisp value of every output variable for a vector
+  // of crisp inputs
+  vector<double> infer(const vector<double> &inputs)
+  {
+    vector<double> crisp(names.size());
+    infer(inputs.data(), crisp.data());
+    return crisp;
+  }
+};
+
+/******* Hierarchical Systems *******/
+// Rows of a batch that go through a stage before the next stage runs, so
+// the rules and the defuzzification tables of a stage stay in cache
+const size_t HIERARCHY_BLOCK = 64;
+
+// Class to chain small fuzzy systems into a DAG of stages
+// Every row holds one slot per system input and one per output variable of
+// a stage. A stage reads its inputs from slots written before it and writes
+// the centroid of each of its output variables, so stages must be added
+// after the stages they read. A stage input written "~V" is a fuzzy link:
+// the rule terms named after the output sets of V take their activations
+// directly instead of fuzzifying the crisp value of V
+class HierarchicalSystem
+{
+private:
+  // Structure holding a stage compiled on its own
+  struct Stage
+  {
+    string name;                      // Name of the stage
+    FlatRuleBase model;               // Rules of the stage
+    vector<size_t> inputSlot;         // Slot feeding every stage input
+    vector<size_t> outputSlot;        // Slot written by every output variable
+    vector<size_t> variableStart;     // First output set of every variable
+    vector<Defuzzifier> defuzzifiers; // Defuzzifier of every variable
+    vector<unsigned> linkedTerms;     // Terms fed by earlier activations
+    vector<size_t> linkedActivations; // Activation feeding every linked term
+    size_t activationStart;           // First activation of the stage
+  };
+
+  vector<string> slotNames;        // Name of every slot
+  vector<size_t> slotSets;         // First activation of every slot
+  vector<size_t> slotSetsEnd;      // End of the activations of every slot
+  vector<size_t> inputSlots;       // Slot of every system input
+  vector<size_t> outputSlots;      // Slot of every stage output variable
+  vector<string> activationNames;  // Output set of every activation
+  vector<Stage> stages;            // Stages in evaluation order
+  vector<double> slots;            // Slots of a block of rows
+  vector<double> activations;      // Activations of a block of rows
+  vector<double> stageInputs;      // Crisp inputs of the current stage
+  vector<double> termDegrees;      // Term degrees of the current stage
+
+  // Method to find a slot by name
+  // Returns -1 if no input or variable has that name
+  int slotOf(const string &name) const
+  {
+    for (size_t s = 0; s < slotNames.size(); s++)
+      if (slotNames[s] == name)
+        return s;
+    return -1;
+  }
+
+  // Method to add a slot with the activations [first, end)
+  size_t addSlot(const string &name, size_t first, size_t end)
+  {
+    slotNames.push_back(name);
+    slotSets.push_back(first);
+    slotSetsEnd.push_back(end);
+    return slotNames.size() - 1;
+  }
+
+  // Method to evaluate a stage for one row
+  void evaluateStage(Stage &stage, double *rowSlots, double *rowActivations)
+  {
+    for (size_t k = 0; k < stage.inputSlot.size(); k++)
+      stageInputs[k] = rowSlots[stage.inputSlot[k]];
+
+    stage.model.fuzzify(stageInputs.data(), termDegrees.data());
+    for (size_t l = 0; l < stage.linkedTerms.size(); l++)
+      termDegrees[stage.linkedTerms[l]] = rowActivations[stage.linkedActivations[l]];
+
+    double *stageActivations = rowActivations + stage.activationStart;
+    stage.model.infer(termDegrees.data(), stageActivations);
+    for (size_t v = 0; v < stage.defuzzifiers.size(); v++)
+      rowSlots[stage.outputSlot[v]] =
+          stage.defuzzifiers[v].defuzzify(stageActivations + stage.variableStart[v]).centroid;
+  }
+
+public:
+  // Method to add a crisp input of the system
+  // Returns false if the name is already used
+  bool addInput(const string &name)
+  {
+    if (slotOf(name) >= 0)
+    {
+      cerr << "Warning: duplicated hierarchy variable: " << name << endl;
+      return false;
+    }
+    inputSlots.push_back(addSlot(name, 0, 0));
+    return true;
+  }
+
+  // Method to add a stage reading the given inputs or earlier variables
+  // The stage terms are routed to its inputs by variable name
+  // Returns false, leaving the system unchanged, if an input is unknown or
+  // an output variable name is already used
+  bool addStage(const string &name, const vector<InputFuzzySet> &inputSets,
+                const Rules &rules, const vector<OutputVariable> &variables,
+                const vector<string> &inputs)
+  {
+    Stage stage;
+    stage.name = name;
+
+    vector<string> inputNames;
+    vector<int> linkedSlots;
+    for (const auto &input : inputs)
+    {
+      bool linked = !input.empty() && input[0] == '~';
+      string inputName = linked ? input.substr(1) : input;
+      int slot = slotOf(inputName);
+      if (slot < 0)
+      {
+        cerr << "Warning: stage " << name << " reads unknown variable: " << inputName << endl;
+        return false;
+      }
+      inputNames.push_back(inputName);
+      stage.inputSlot.push_back(slot);
+      if (linked)
+        linkedSlots.push_back(slot);
+    }
+
+    vector<OutputFuzzySet> outputSets;
+    for (const auto &variable : variables)
+    {
+      if (slotOf(variable.name) >= 0)
+      {
+        cerr << "Warning: duplicated hierarchy variable: " << variable.name << endl;
+        return false;
+      }
+      stage.variableStart.push_back(outputSets.size());
+      outputSets.insert(outputSets.end(), variable.sets.begin(), variable.sets.end());
+      stage.defuzzifiers.push_back(Defuzzifier(variable.sets));
+    }
+    stage.model.compile(inputSets, rules, outputSets, inputNames.size(), inputNames);
+
+    // Terms named after the output sets of a linked variable use their
+    // activations
+    for (int slot : linkedSlots)
+      for (size_t a = slotSets[slot]; a < slotSetsEnd[slot]; a++)
+        for (size_t t = 0; t < stage.model.termNames.size(); t++)
+          if (stage.model.termNames[t] == activationNames[a])
+          {
+            stage.linkedTerms.push_back(t);
+            stage.linkedActivations.push_back(a);
+          }
+
+    // Every activation of the stage model gets a place, including
+    // consequents without an output set
+    stage.activationStart = activationNames.size();
+    activationNames.insert(activationNames.end(), stage.model.outputNames.begin(),
+                           stage.model.outputNames.end());
+    for (size_t v = 0; v < variables.size(); v++)
+    {
+      size_t first = stage.activationStart + stage.variableStart[v];
+      size_t slot = addSlot(variables[v].name, first, first + variables[v].sets.size());
+      stage.outputSlot.push_back(slot);
+      outputSlots.push_back(slot);
+    }
+
+    stageInputs.resize(max(stageInputs.size(), inputNames.size()));
+    termDegrees.resize(max(termDegrees.size(), stage.model.termNames.size()));
+    stages.push_back(stage);
+    return true;
+  }
+
+  // Method to get the number of stages
+  size_t stageCount() const { return stages.size(); }
+
+  // Method to get the number of crisp inputs of the system
+  size_t inputCount() const { return inputSlots.size(); }
+
+  // Method to get the number of output variables of all the stages
+  size_t outputCount() const { return outputSlots.size(); }
+
+  // Method to get the name of an output variable
+  const string &outputName(size_t o) const { return slotNames[outputSlots[o]]; }
+
+  // Method to infer a batch of rows
+  // rows holds rowCount rows of inputCount() values and outputs receives
+  // rowCount rows of outputCount() values. Blocks of rows go through the
+  // stages one stage at a time
+  void inferBatch(const double *rows, size_t rowCount, double *outputs)
+  {
+    size_t slotCount = slotNames.size();
+    size_t activationCount = activationNames.size();
+    slots.resize(HIERARCHY_BLOCK * slotCount);
+    activations.resize(HIERARCHY_BLOCK * activationCount);
+
+    for (size_t first = 0; first < rowCount; first += HIERARCHY_BLOCK)
+    {
+      size_t count = min(HIERARCHY_BLOCK, rowCount - first);
+      for (size_t r = 0; r < count; r++)
+        for (size_t i = 0; i < inputSlots.size(); i++)
+          slots[r * slotCount + inputSlots[i]] = rows[(first + r) * inputSlots.size() + i];
+
+      for (auto &stage : stages)
+        for (size_t r = 0; r < count; r++)
+          evaluateStage(stage, &slots[r * slotCount], &activations[r * activationCount]);
+
+      for (size_t r = 0; r < count; r++)
+        for (size_t o = 0; o < outputSlots.size(); o++)
+          outputs[(first + r) * outputSlots.size() + o] = slots[r * slotCount + outputSlots[o]];
+    }
+  }
+
+  // Method to infer the output variables for one row of crisp inputs
+  vector<double> infer(const vector<double> &inputs)
+  {
+    vector<double> outputs(outputSlots.size());
+    inferBatch(inputs.data(), 1, outputs.data());
+    return outputs;
+  }
+};
+
+/******* Inference Policies *******/
+// Compiled without fused multiply-adds like the reproducible reductions,
+// since operators such as a + b - a * b would otherwise round differently
+// on every target
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off")
+
+// Norm families pair a t-norm, used for AND, with its dual s-norm, used for
+// OR. They are template arguments of PolicyEngine so the inner loops call
+// the operators directly instead of dispatching at runtime
+
+// Zadeh norms: minimum and maximum (the operators of fAnd and fOr)
+struct ZadehNorms
+{
+  static double tnorm(double a, double b) { return min(a, b); }
+  static double snorm(double a, double b) { return max(a, b); }
+};
+
+// Product t-norm and probabilistic sum
+struct ProductNorms
+{
+  static double tnorm(double a, double b) { return a * b; }
+  static double snorm(double a, double b) { return a + b - a * b; }
+};
+
+// Lukasiewicz t-norm and bounded sum
+struct LukasiewiczNorms
+{
+  static double tnorm(double a, double b) { return max(0.0, a + b - 1); }
+  static double snorm(double a, double b) { return min(1.0, a + b); }
+};
+
+// Hamacher product and Hamacher sum
+struct HamacherNorms
+{
+  static double tnorm(double a, double b)
+  {
+    double d = a + b - a * b;
+    return d > 0 ? a * b / d : 0;
+  }
+  static double snorm(double a, double b)
+  {
+    double d = 1 - a * b;
+    return d > 0 ? (a + b - 2 * a * b) / d : 1;
+  }
+};
+
+// Einstein product and Einstein sum
+struct EinsteinNorms
+{
+  static double tnorm(double a, double b) { return a * b / (2 - (a + b - a * b)); }
+  static double snorm(double a, double b) { return (a + b) / (1 + a * b); }
+};
+
+// Implication policies shape an output set with the firing strength of a
+// rule. Both give 0 for a rule that does not fire
+
+// Mamdani implication: clips the output set at the firing strength
+struct MinImplication
+{
+  static double apply(double strength, double mu) { return min(strength, mu); }
+};
+
+// Larsen implication: scales the output set by the firing strength
+struct ProductImplication
+{
+  static double apply(double strength, double mu) { return strength * mu; }
+};
+
+// Aggregation policies combine the implied sets of all the rules, sample
+// by sample. All of them have 0 as identity
+
+// Maximum aggregation (the one of Rules::inferMamdani)
+struct MaxAggregation
+{
+  static double apply(double total, double mu) { return max(total, mu); }
+};
+
+// Sum aggregation, not limited to 1
+struct SumAggregation
+{
+  static double apply(double total, double mu) { return total + mu; }
+};
+
+// Bounded sum aggregation
+struct BoundedSumAggregation
+{
+  static double apply(double total, double mu) { return min(1.0, total + mu); }
+};
+
+// Probabilistic OR aggregation
+struct ProbabilisticOrAggregation
+{
+  static double apply(double total, double mu) { return total + mu - total * mu; }
+};
+
+// Different norm families that can be selected in a model file
+enum NormFamily
+{
+  ZADEH_NORMS,       // Minimum and maximum
+  PRODUCT_NORMS,     // Product and probabilistic sum
+  LUKASIEWICZ_NORMS, // Lukasiewicz t-norm and bounded sum
+  HAMACHER_NORMS,    // Hamacher product and sum
+  EINSTEIN_NORMS     // Einstein product and sum
+};
+
+// Different implication methods that can be selected in a model file
+enum ImplicationMethod
+{
+  MIN_IMPLICATION,    // Mamdani clipping
+  PRODUCT_IMPLICATION // Larsen scaling
+};
+
+// Different aggregation methods that can be selected in a model file
+enum AggregationMethod
+{
+  MAX_AGGREGATION,         // Maximum
+  SUM_AGGREGATION,         // Sum
+  BOUNDED_SUM_AGGREGATION, // Sum limited to 1
+  PROBOR_AGGREGATION       // Probabilistic OR
+};
+
+// Structure holding the operators selected for a fuzzy system
+// The defaults are the operators of Rules::inferMamdani
+struct InferencePolicy
+{
+  NormFamily norms = ZADEH_NORMS;
+  ImplicationMethod implication = MIN_IMPLICATION;
+  AggregationMethod aggregation = MAX_AGGREGATION;
+  ReductionMode reduction = FAST_REDUCTION;
+};
+
+// Interface of the engines created by makeInferenceEngine
+class InferenceEngine
+{
+public:
+  virtual ~InferenceEngine() {}
+
+  // Method to run the whole pipeline on one row of crisp inputs
+  // Returns the crisp output (centroid of the aggregated output)
+  virtual double infer(const double *inputs) = 0;
+
+  // Method to run the whole pipeline on a vector of crisp inputs
+  double infer(const vector<double> &inputs) { return infer(inputs.data()); }
+};
+
+// Class implementing the fuzzification, rule evaluation, implication,
+// aggregation and centroid defuzzification with operators fixed at compile
+// time
+// Rules are evaluated from left to right like in Rules::inferMamdani, and
+// every firing rule contributes its own implied set to the aggregation
+template <class Norms, class Implication, class Aggregation>
+class PolicyEngine : public InferenceEngine
+{
+private:
+  FlatRuleBase model;             // Rules compiled into flat arrays
+  vector<double> sampleX;         // Point of every defuzzification sample
+  vector<double> shapes;          // Membership of every output set at every sample
+  vector<double> termDegrees;     // Membership degree of every term
+  vector<double> aggregated;      // Aggregated output at every sample, or
+                                  // height of every singleton
+  vector<OutputFuzzySet> outputs; // Output sets, kept for singleton models
+  bool singletons;                // All output sets are singletons
+  double lo, hi;                  // Universe of the output sets
+  ReductionMode mode;             // How the centroid sums are taken
+
+public:
+  // Constructor of the class
+  // Compiles the rules and samples the output sets once
+  PolicyEngine(const vector<InputFuzzySet> &inputSets, const Rules &rules,
+               const vector<OutputFuzzySet> &outputSets, size_t inputCount,
+               ReductionMode reductionMode = FAST_REDUCTION)
+      : mode(reductionMode)
+  {
+    model.compile(inputSets, rules, outputSets, inputCount);
+    outputUniverse(outputSets, lo, hi);
+    outputs = outputSets;
+    singletons = allSingletons(outputSets);
+
+    double step = (hi - lo) / (DEFUZZ_SAMPLES - 1);
+    for (int i = 0; i < DEFUZZ_SAMPLES; i++)
+      sampleX.push_back(samplePoint(lo, step, i));
+
+    // Consequents without an output set keep an empty shape
+    shapes.assign(model.outputNames.size() * DEFUZZ_SAMPLES, 0);
+    for (size_t k = 0; k < outputSets.size(); k++)
+      for (int i = 0; i < DEFUZZ_SAMPLES; i++)
+        shapes[k * DEFUZZ_SAMPLES + i] = outputSets[k].eval(sampleX[i]);
+
+    termDegrees.resize(model.termNames.size());
+    aggregated.resize(singletons ? model.outputNames.size() : DEFUZZ_SAMPLES);
+  }
+
+  // Method to run the whole pipeline on one row of crisp inputs
+  double infer(const double *inputs) override
+  {
+    model.fuzzify(inputs, termDegrees.data());
+    fill(aggregated.begin(), aggregated.end(), 0.0);
+
+    bool fired = false;
+    for (size_t r = 0; r < model.ruleCount(); r++)
+    {
+      // Firing strength with the t-norm and s-norm of the family
+      double strength = termDegrees[model.ruleTerms[model.ruleStart[r]]];
+      for (size_t a = model.ruleStart[r] + 1; a < model.ruleStart[r + 1]; a++)
+      {
+        double degree = termDegrees[model.ruleTerms[a]];
+        strength = model.ruleOps[a] == AND_OP ? Norms::tnorm(degree, strength)
+                                              : Norms::snorm(degree, strength);
+      }
+      if (strength <= 0)
+        continue; // The implied set is empty and 0 is the aggregation identity
+
+      // The implied singleton of the rule has height Implication(strength, 1)
+      // and is aggregated with the others at the same position
+      if (singletons)
+      {
+        double &height = aggregated[model.ruleOutput[r]];
+        height = Aggregation::apply(height, Implication::apply(strength, 1.0));
+        continue;
+      }
+
+      // Add the implied set of the rule to the aggregated output
+      const double *shape = &shapes[model.ruleOutput[r] * DEFUZZ_SAMPLES];
+      for (int i = 0; i < DEFUZZ_SAMPLES; i++)
+        aggregated[i] = Aggregation::apply(aggregated[i], Implication::apply(strength, shape[i]));
+      fired = true;
+    }
+
+    if (singletons)
+      return defuzzifySingletons(outputs, aggregated.data(), nullptr, mode);
+
+    double numerator = 0, denominator = 0;
+    if (!fired)
+      return (lo + hi) / 2;
+    if (mode == DETERMINISTIC_REDUCTION)
+    {
+      numerator = reproducibleDot(sampleX.data(), aggregated.data(), DEFUZZ_SAMPLES);
+      denominator = reproducibleSum(aggregated.data(), DEFUZZ_SAMPLES);
+    }
+    else
+    {
+      for (int i = 0; i < DEFUZZ_SAMPLES; i++)
+      {
+        numerator += sampleX[i] * aggregated[i];
+        denominator += aggregated[i];
+      }
+    }
+    if (denominator <= 0)
+      return (lo + hi) / 2;
+    return numerator / denominator;
+  }
+};
+
+// Function to create the engine instantiated for a norm family, an
+// implication and the aggregation of the policy
+template <class Norms, class Implication>
+unique_ptr<InferenceEngine> makeAggregatingEngine(const InferencePolicy &policy,
+                                                  const vector<InputFuzzySet> &inputSets,
+                                                  const Rules &rules,
+                                                  const vector<OutputFuzzySet> &outputSets,
+                                                  size_t inputCount)
+{
+  switch (policy.aggregation)
+  {
+  case SUM_AGGREGATION:
+    return make_unique<PolicyEngine<Norms, Implication, SumAggregation>>(
+        inputSets, rules, outputSets, inputCount, policy.reduction);
+  case BOUNDED_SUM_AGGREGATION:
+    return make_unique<PolicyEngine<Norms, Implication, BoundedSumAggregation>>(
+        inputSets, rules, outputSets, inputCount, policy.reduction);
+  case PROBOR_AGGREGATION:
+    return make_unique<PolicyEngine<Norms, Implication, ProbabilisticOrAggregation>>(
+        inputSets, rules, outputSets, inputCount, policy.reduction);
+  default:
+    return make_unique<PolicyEngine<Norms, Implication, MaxAggregation>>(
+        inputSets, rules, outputSets, inputCount, policy.reduction);
+  }
+}
+
+// Function to create the engine instantiated for a norm family and the
+// implication and aggregation of the policy
+template <class Norms>
+unique_ptr<InferenceEngine> makeImplyingEngine(const InferencePolicy &policy,
+                                               const vector<InputFuzzySet> &inputSets,
+                                               const Rules &rules,
+                                               const vector<OutputFuzzySet> &outputSets,
+                                               size_t inputCount)
+{
+  if (policy.implication == PRODUCT_IMPLICATION)
+    return makeAggregatingEngine<Norms, ProductImplication>(policy, inputSets, rules,
+                                                            outputSets, inputCount);
+  return makeAggregatingEngine<Norms, MinImplication>(policy, inputSets, rules,
+                                                      outputSets, inputCount);
+}
+
+// Function to create the engine for the operators of a policy
+// Every combination of operators is instantiated at compile time; this
+// only picks one of them
+unique_ptr<InferenceEngine> makeInferenceEngine(const InferencePolicy &policy,
+                                                const vector<InputFuzzySet> &inputSets,
+                                                const Rules &rules,
+                                                const vector<OutputFuzzySet> &outputSets,
+                                                size_t inputCount = 0)
+{
+  switch (policy.norms)
+  {
+  case PRODUCT_NORMS:
+    return makeImplyingEngine<ProductNorms>(policy, inputSets, rules, outputSets, inputCount);
+  case LUKASIEWICZ_NORMS:
+    return makeImplyingEngine<LukasiewiczNorms>(policy, inputSets, rules, outputSets, inputCount);
+  case HAMACHER_NORMS:
+    return makeImplyingEngine<HamacherNorms>(policy, inputSets, rules, outputSets, inputCount);
+  case EINSTEIN_NORMS:
+    return makeImplyingEngine<EinsteinNorms>(policy, inputSets, rules, outputSets, inputCount);
+  default:
+    return makeImplyingEngine<ZadehNorms>(policy, inputSets, rules, outputSets, inputCount);
+  }
+}
+
+#pragma GCC pop_options
+
+/******* Takagi-Sugeno-Kang Inference *******/
+// Function to parse the consequent of a TSK rule
+// Accepts a constant ("12.5") or a linear function of the crisp inputs
+// written without spaces, where xi is input i ("5+0.1*x0-0.02*x1")
+// coefficients receives the constant followed by the coefficient of every
+// input
+// Returns false if the text is not a constant or a linear function of the
+// inputs, e.g. the name of an output fuzzy set
+bool parseTskConsequent(const string &text, size_t inputCount,
+                        vector<double> &coefficients)
+{
+  coefficients.assign(inputCount + 1, 0);
+  const char *p = text.c_str();
+  if (*p == 0)
+    return false;
+
+  while (*p)
+  {
+    // Every term but the first starts with its sign
+    double sign = 1;
+    if (*p == '+' || *p == '-')
+      sign = *p++ == '-' ? -1 : 1;
+    else if (p != text.c_str())
+      return false;
+
+    // Coefficient of the term, implicitly 1 before a bare input
+    double value = 1;
+    if (*p != 'x')
+    {
+      char *end;
+      value = strtod(p, &end);
+      if (end == p || !isfinite(value))
+        return false;
+      p = end;
+      if (*p != '*')
+      {
+        coefficients[0] += sign * value; // Constant term
+        continue;
+      }
+      p++;
+    }
+
+    // Input multiplied by the coefficient
+    if (*p++ != 'x')
+      return false;
+    char *end;
+    long input = strtol(p, &end, 10);
+    if (end == p || input < 0 || (size_t)input >= inputCount)
+      return false;
+    p = end;
+    coefficients[input + 1] += sign * value;
+  }
+  return true;
+}
+
+// Function to compute the dot product of two spans
+// Uses two vector accumulators when SIMD is available
+double dotProduct(const double *a, const double *b, size_t count)
+{
+  double sum = 0;
+  size_t i = 0;
+
+#ifdef LANE_LOAD
+  if (count >= LANE_WIDTH)
+  {
+    LaneVector s0 = LANE_ZERO(), s1 = LANE_ZERO();
+    for (; i + 2 * LANE_WIDTH <= count; i += 2 * LANE_WIDTH)
+    {
+      s0 = LANE_ADD(s0, LANE_MUL(LANE_LOAD(a + i), LANE_LOAD(b + i)));
+      s1 = LANE_ADD(s1, LANE_MUL(LANE_LOAD(a + i + LANE_WIDTH),
+                                 LANE_LOAD(b + i + LANE_WIDTH)));
+    }
+    if (i + LANE_WIDTH <= count)
+    {
+      s0 = LANE_ADD(s0, LANE_MUL(LANE_LOAD(a + i), LANE_LOAD(b + i)));
+      i += LANE_WIDTH;
+    }
+
+    double lanes[LANE_WIDTH];
+    LANE_STORE(lanes, LANE_ADD(s0, s1));
+    for (size_t l = 0; l < LANE_WIDTH; l++)
+      sum += lanes[l];
+  }
+#endif
+
+  // Remaining values, or all of them without SIMD
+  for (; i < count; i++)
+    sum += a[i] * b[i];
+  return sum;
+}
+
+// Class implementing Takagi-Sugeno-Kang inference
+// Every rule has a constant or linear consequent z_r (see
+// parseTskConsequent) and the crisp output is the weighted average of the
+// consequents, sum(w_r * z_r) / sum(w_r), where w_r is the firing strength
+// Fuzzification and antecedent evaluation are those of FlatRuleBase, so the
+// rules are evaluated like in Rules::inferMamdani
+class TskEngine
+{
+private:
+  FlatRuleBase model;          // Rules compiled into flat arrays
+  size_t inputCount;           // Number of crisp inputs
+  vector<double> coefficients; // Coefficient j of rule r at j * rules + r
+  vector<double> termDegrees;  // Membership degree of every term
+  vector<double> strengths;    // Firing strength of every rule
+  vector<double> slopes;       // sum(w_r * ci_r) for every input i
+  bool valid;                  // All consequents are constant or linear
+  ReductionMode mode;          // How the weighted sums are taken
+
+public:
+  // Constructor of the class
+  // Compiles the rules and parses their consequents
+  TskEngine(const vector<InputFuzzySet> &inputSets, const Rules &rules,
+            size_t inputs = 0, ReductionMode reductionMode = FAST_REDUCTION)
+      : valid(true), mode(reductionMode)
+  {
+    model.compile(inputSets, rules, vector<OutputFuzzySet>(), inputs);
+    inputCount = model.inputCount;
+
+    // Parse every distinct consequent once
+    vector<vector<double>> outputCoefficients(model.outputNames.size());
+    for (size_t k = 0; k < model.outputNames.size(); k++)
+      if (!parseTskConsequent(model.outputNames[k], inputCount, outputCoefficients[k]))
+      {
+        std::cerr << "Warning: " << model.outputNames[k]
+                  << " is not a TSK consequent" << std::endl;
+        valid = false;
+      }
+
+    // Store the coefficients by rule so the consequent step is a dot
+    // product over the rules
+    size_t ruleCount = model.ruleCount();
+    coefficients.assign((inputCount + 1) * ruleCount, 0);
+    for (size_t r = 0; r < ruleCount; r++)
+      for (size_t j = 0; j <= inputCount; j++)
+        coefficients[j * ruleCount + r] = outputCoefficients[model.ruleOutput[r]][j];
+
+    termDegrees.resize(model.termNames.size());
+    strengths.resize(ruleCount);
+    slopes.resize(inputCount);
+  }
+
+  // Method to know if every consequent is a constant or a linear function
+  bool isValid() const { return valid; }
+
+  // Method to get the number of rules
+  size_t size() const { return model.ruleCount(); }
+
+  // Method to infer the crisp output for one row of crisp inputs
+  // Returns 0 if no rule fires
+  double infer(const double *inputs)
+  {
+    model.fuzzify(inputs, termDegrees.data());
+
+    size_t ruleCount = model.ruleCount();
+    double total = 0;
+    for (size_t r = 0; r < ruleCount; r++)
+    {
+      strengths[r] = model.evaluateRule(r, termDegrees.data());
+      total += strengths[r];
+    }
+    if (total <= 0)
+      return 0;
+
+    // sum(w_r * z_r) = sum(w_r * c0_r) + sum_i x_i * sum(w_r * ci_r)
+    // The deterministic mode does not depend on the lanes of dotProduct nor
+    // on fused multiply-adds
+    if (mode == DETERMINISTIC_REDUCTION)
+    {
+      total = reproducibleSum(strengths.data(), ruleCount);
+      for (size_t i = 0; i < inputCount; i++)
+        slopes[i] = reproducibleDot(strengths.data(), &coefficients[(i + 1) * ruleCount], ruleCount);
+      return (reproducibleDot(strengths.data(), coefficients.data(), ruleCount) +
+              reproducibleDot(inputs, slopes.data(), inputCount)) /
+             total;
+    }
+
+    double weighted = dotProduct(strengths.data(), coefficients.data(), ruleCount);
+    for (size_t i = 0; i < inputCount; i++)
+      weighted += inputs[i] * dotProduct(strengths.data(), &coefficients[(i + 1) * ruleCount], ruleCount);
+    return weighted / total;
+  }
+
+  // Method to infer the crisp output for a vector of crisp inputs
+  double infer(const vector<double> &inputs) { return infer(inputs.data()); }
+};
+
+/******* Incremental Inference *******/
+// Class to re-run Mamdani inference when only some inputs change
+// The membership degree of every term and the firing strength of every
+// rule are cached. Changing an input refuzzifies only the terms of that
+// input and re-evaluates only the rules that use one of the changed terms.
+// Every output set keeps its rules in an indexed max-heap keyed on the
+// firing strength, so lowering the strongest rule is handled correctly.
+// The results equal those of Rules::inferMamdani on the same inputs
+class IncrementalInference
+{
+private:
+  FlatRuleBase model;                  // Compiled rules
+  vector<vector<unsigned>> termRules;  // Rules that use every term
+  vector<vector<unsigned>> inputTerms; // Terms fed by every input
+
+  vector<double> inputs;       // Current crisp inputs
+  vector<double> termDegrees;  // Cached membership degrees
+  vector<double> strengths;    // Cached firing strengths
+  vector<vector<unsigned>> heaps; // Max-heap of rules of every output set
+  vector<size_t> heapPos;      // Position of every rule in its heap
+  vector<size_t> ruleStamp;    // Update in which a rule was last evaluated
+  size_t stamp = 0;            // Number of updates performed
+  size_t lastEvaluations = 0;  // Rules evaluated by the last update
+
+  // Helpers to restore the heap order after the strength of a rule changed
+  void siftUp(vector<unsigned> &heap, size_t i)
+  {
+    while (i > 0)
+    {
+      size_t parent = (i - 1) / 2;
+      if (strengths[heap[parent]] >= strengths[heap[i]])
+        break;
+      swap(heap[parent], heap[i]);
+      heapPos[heap[parent]] = parent;
+      heapPos[heap[i]] = i;
+      i = parent;
+    }
+  }
+
+  void siftDown(vector<unsigned> &heap, size_t i)
+  {
+    while (true)
+    {
+      size_t largest = i;
+      for (size_t child = 2 * i + 1; child <= 2 * i + 2; child++)
+        if (child < heap.size() && strengths[heap[child]] > strengths[heap[largest]])
+          largest = child;
+      if (largest == i)
+        break;
+      swap(heap[largest], heap[i]);
+      heapPos[heap[largest]] = largest;
+      heapPos[heap[i]] = i;
+      i = largest;
+    }
+  }
+
+public:
+  // Constructor that compiles the rules against the input fuzzy sets
+  // inputCount is the number of crisp inputs, routed with inputIndexOf
+  // (0 takes it from the declared input variables)
+  IncrementalInference(const vector<InputFuzzySet> &inputSets,
+                       const Rules &rules, size_t inputCount = 0)
+  {
+    model.compile(inputSets, rules, vector<OutputFuzzySet>(), inputCount);
+    inputTerms.resize(model.inputCount);
+    inputs.assign(model.inputCount, 0);
+
+    for (size_t t = 0; t < model.termInput.size(); t++)
+      if (model.termInput[t] >= 0)
+        inputTerms[model.termInput[t]].push_back(t);
+
+    // Rules that use every term, each rule listed once per term
+    termRules.resize(model.termNames.size());
+    for (size_t r = 0; r < model.ruleCount(); r++)
+      for (size_t a = model.ruleStart[r]; a < model.ruleStart[r + 1]; a++)
+      {
+        vector<unsigned> &users = termRules[model.ruleTerms[a]];
+        if (users.empty() || users.back() != r)
+          users.push_back(r);
+      }
+
+    size_t ruleCount = model.ruleCount();
+    termDegrees.assign(model.termNames.size(), 0);
+    strengths.assign(ruleCount, 0);
+    ruleStamp.assign(ruleCount, 0);
+    heapPos.assign(ruleCount, 0);
+    heaps.assign(model.outputNames.size(), vector<unsigned>());
+    for (size_t r = 0; r < ruleCount; r++)
+    {
+      heapPos[r] = heaps[model.ruleOutput[r]].size();
+      heaps[model.ruleOutput[r]].push_back(r);
+    }
+
+    setInputs(inputs);
+  }
+
+  // Method to evaluate all the terms and rules for new crisp inputs
+  void setInputs(const vector<double> &crispInputs)
+  {
+    for (size_t i = 0; i < inputs.size() && i < crispInputs.size(); i++)
+      inputs[i] = crispInputs[i];
+
+    model.fuzzify(inputs.data(), termDegrees.data());
+    for (size_t r = 0; r < strengths.size(); r++)
+      strengths[r] = model.evaluateRule(r, termDegrees.data());
+
+    // Rebuild every heap from scratch
+    for (auto &heap : heaps)
+      for (size_t i = heap.size() / 2; i-- > 0;)
+        siftDown(heap, i);
+
+    lastEvaluations = strengths.size();
+  }
+
+  // Method to change a single crisp input
+  // Only the terms of the input and the rules that use them are evaluated
+  void setInput(size_t input, double x)
+  {
+    inputs[input] = x;
+    stamp++;
+    lastEvaluations = 0;
+
+    // Refuzzify the terms of the input, keeping the ones that changed
+    vector<unsigned> changed;
+    for (unsigned t : inputTerms[input])
+    {
+      double degree = model.termSets[t].eval(x);
+      if (degree != termDegrees[t])
+      {
+        termDegrees[t] = degree;
+        changed.push_back(t);
+      }
+    }
+
+    // Re-evaluate every rule that uses a changed term once
+    for (unsigned t : changed)
+    {
+      for (unsigned r : termRules[t])
+      {
+        if (ruleStamp[r] == stamp)
+          continue; // Already evaluated in this update
+        ruleStamp[r] = stamp;
+        lastEvaluations++;
+
+        double previous = strengths[r];
+        strengths[r] = model.evaluateRule(r, termDegrees.data());
+        vector<unsigned> &heap = heaps[model.ruleOutput[r]];
+        if (strengths[r] > previous)
+          siftUp(heap, heapPos[r]);
+        else if (strengths[r] < previous)
+          siftDown(heap, heapPos[r]);
+      }
+    }
+  }
+
+  // Method to get the number of rules evaluated by the last update
+  size_t getLastEvaluations() const { return lastEvaluations; }
+
+  // Method to get the aggregated output membership values
+  // The activation of every output set is the top of its heap
+  map<string, double> getOutputValues() const
+  {
+    map<string, double> output;
+    for (size_t k = 0; k < model.outputNames.size(); k++)
+      output[model.outputNames[k]] =
+          heaps[k].empty() ? 0 : fOr(0.0, strengths[heaps[k].front()]);
+    return output;
+  }
+};
+
+// Function to run the whole Mamdani pipeline on crisp inputs
+// Fuzzifies inputs[inputIndexOf(set)] for every input set, infers with the
+// rules and defuzzifies with the centroid method
+// Returns the crisp output
+double inferCrisp(const vector<InputFuzzySet> &inputSets, const Rules &rules,
+                  const vector<OutputFuzzySet> &outputSets,
+                  const vector<double> &inputs)
+{
+  map<string, double> inputMembershipValues;
+  for (const auto &inputSet : inputSets)
+  {
+    int input = inputIndexOf(inputSet);
+    if (input >= 0 && (size_t)input < inputs.size())
+      inputMembershipValues[inputSet.getName()] = inputSet.eval(inputs[input]);
+  }
+
+  return defuzzifyCentroid(outputSets, rules.inferMamdani(inputMembershipValues));
+}
+
+/******* Inference Cache *******/
+// Class to memoize inference results keyed on the crisp inputs
+// Inputs are quantized to a resolution before being used as a key, so
+// inputs closer than the resolution share one entry, and results are
+// computed on the quantized inputs so an entry does not depend on which
+// input created it. A resolution of 0 keys on the raw bit patterns of the
+// inputs instead (exact mode).
+// The cache is split into shards, each with its own lock and LRU list, so
+// concurrent callers rarely wait on each other. Memory is bounded by a byte
+// budget shared evenly between the shards
+class InferenceCache
+{
+private:
+  // Shard of the cache: an LRU list of entries and a map into it
+  struct Shard
+  {
+    mutex lock;                              // Protects the shard
+    list<pair<string, vector<double>>> lru;  // Entries, most recent first
+    unordered_map<string, list<pair<string, vector<double>>>::iterator> index;
+    size_t bytes = 0;                        // Memory used by the entries
+  };
+
+  vector<Shard> shards;         // Shards of the cache
+  size_t shardBudget;           // Byte budget of every shard
+  double resolution;            // Quantization step, 0 for exact keys
+  atomic<size_t> hits{0};       // Lookups answered from the cache
+  atomic<size_t> misses{0};     // Lookups that ran the inference
+  atomic<size_t> evictions{0};  // Entries dropped to respect the budget
+
+  // Helper to estimate the memory used by an entry
+  static size_t entryBytes(const string &key, const vector<double> &value)
+  {
+    // Key and value storage plus the list node, the map node and its bucket
+    return key.size() + value.size() * sizeof(double) +
+           sizeof(pair<string, vector<double>>) + 4 * sizeof(void *) +
+           sizeof(string) + 2 * sizeof(void *);
+  }
+
+public:
+  // Constructor that sets the byte budget, the quantization resolution
+  // (0 for exact keys) and the number of shards
+  InferenceCache(size_t byteBudget, double res = 0, size_t shardCount = 16)
+      : shards(max<size_t>(shardCount, 1)),
+        shardBudget(byteBudget / max<size_t>(shardCount, 1)), resolution(res)
+  {
+  }
+
+  // Method to get the cached result for some crisp inputs
+  // On a miss compute(quantizedInputs) is called and its result stored
+  // compute runs without holding any lock, so with concurrent callers it
+  // must be thread-safe, e.g. inferCrisp over const rules
+  template <class F>
+  vector<double> get(const vector<double> &inputs, F compute)
+  {
+    // Build the key and the inputs it stands for
+    vector<double> keyInputs = inputs;
+    string key(inputs.size() * sizeof(int64_t), '\0');
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+      int64_t bits;
+      if (resolution > 0)
+      {
+        bits = llround(inputs[i] / resolution);
+        keyInputs[i] = bits * resolution;
+      }
+      else
+        memcpy(&bits, &inputs[i], sizeof(bits));
+      memcpy(&key[i * sizeof(bits)], &bits, sizeof(bits));
+    }
+
+    Shard &shard = shards[hash<string>()(key) % shards.size()];
+    {
+      lock_guard<mutex> guard(shard.lock);
+      auto found = shard.index.find(key);
+      if (found != shard.index.end())
+      {
+        // Move the entry to the front of the LRU list
+        shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+        hits++;
+        return found->second->second;
+      }
+    }
+
+    misses++;
+    vector<double> value = compute(keyInputs);
+    size_t bytes = entryBytes(key, value);
+    if (bytes > shardBudget)
+      return value; // Too large to ever be cached
+
+    lock_guard<mutex> guard(shard.lock);
+    if (shard.index.find(key) != shard.index.end())
+      return value; // Another caller stored it meanwhile
+
+    // Evict the least recently used entries until the new one fits
+    while (shard.bytes + bytes > shardBudget && !shard.lru.empty())
+    {
+      auto &last = shard.lru.back();
+      shard.bytes -= entryBytes(last.first, last.second);
+      shard.index.erase(last.first);
+      shard.lru.pop_back();
+      evictions++;
+    }
+
+    shard.lru.emplace_front(key, value);
+    shard.index[key] = shard.lru.begin();
+    shard.bytes += bytes;
+    return value;
+  }
+
+  // Methods to get the counters of the cache
+  size_t getHits() const { return hits; }
+  size_t getMisses() const { return misses; }
+  size_t getEvictions() const { return evictions; }
+
+  // Method to get the memory used by the entries of all shards
+  size_t bytesUsed()
+  {
+    size_t total = 0;
+    for (auto &shard : shards)
+    {
+      lock_guard<mutex> guard(shard.lock);
+      total += shard.bytes;
+    }
+    return total;
+  }
+
+  // Method to drop every entry, keeping the counters
+  void clear()
+  {
+    for (auto &shard : shards)
+    {
+      lock_guard<mutex> guard(shard.lock);
+      shard.lru.clear();
+      shard.index.clear();
+      shard.bytes = 0;
+    }
+  }
+};
+
+/******* Row-Interleaved Kernels *******/
+// Number of rows evaluated together by the row-interleaved kernels
+const size_t ROW_BLOCK = 16;
+
+// Function to evaluate a list of rules on ROW_BLOCK rows at once
+// degrees holds the membership of every term for every row interleaved as
+// degrees[term * ROW_BLOCK + lane], and activation the output activations
+// the same way. The firing strength of every rule is built with lane-wise
+// min (AND) and max (OR) over contiguous loads, and aggregated into its
+// output set with a lane-wise max
+void evaluateRowBlock(const FlatRuleBase &model, const double *degrees,
+                      const vector<unsigned> &rules, double *activation)
+{
+  for (unsigned r : rules)
+  {
+    const double *first = degrees + model.ruleTerms[model.ruleStart[r]] * ROW_BLOCK;
+    double *out = activation + model.ruleOutput[r] * ROW_BLOCK;
+
+#ifdef LANE_LOAD
+    for (size_t v = 0; v < ROW_BLOCK; v += LANE_WIDTH)
+    {
+      LaneVector strength = LANE_LOAD(first + v);
+      for (size_t a = model.ruleStart[r] + 1; a < model.ruleStart[r + 1]; a++)
+      {
+        LaneVector term = LANE_LOAD(degrees + model.ruleTerms[a] * ROW_BLOCK + v);
+        strength = model.ruleOps[a] == AND_OP ? LANE_MIN(term, strength)
+                                               : LANE_MAX(term, strength);
+      }
+      LANE_STORE(out + v, LANE_MAX(LANE_LOAD(out + v), strength));
+    }
+#else
+    double strength[ROW_BLOCK];
+    for (size_t l = 0; l < ROW_BLOCK; l++)
+      strength[l] = first[l];
+
+    for (size_t a = model.ruleStart[r] + 1; a < model.ruleStart[r + 1]; a++)
+    {
+      const double *term = degrees + model.ruleTerms[a] * ROW_BLOCK;
+      if (model.ruleOps[a] == AND_OP)
+        for (size_t l = 0; l < ROW_BLOCK; l++)
+          strength[l] = fAnd(term[l], strength[l]);
+      else
+        for (size_t l = 0; l < ROW_BLOCK; l++)
+          strength[l] = fOr(term[l], strength[l]);
+    }
+
+    for (size_t l = 0; l < ROW_BLOCK; l++)
+      out[l] = fOr(out[l], strength[l]);
+#endif
+  }
+}
+
+// Number of rules evaluated together by the gather kernel
+const size_t RULE_PACK = 16;
+
+// Class to evaluate the rules of a single inference RULE_PACK at a time
+// Rules are sorted by output set and arity and stored in packs: for every
+// antecedent position the packs hold the term index of each lane and
+// whether the lane applies OR at that position. Each position is loaded
+// with one gather per vector from the term degrees, and the lanes are
+// combined with vector min/max. Lanes shorter than the pack repeat AND
+// with a term of degree 1, and unused lanes read a term of degree 0.
+// Most packs feed a single output set and are max-reduced into it; the
+// others are scattered lane by lane so lanes with equal outputs do not
+// overwrite each other
+class RuleGatherKernel
+{
+private:
+  // Pack of RULE_PACK rules
+  struct Pack
+  {
+    size_t offset;     // First entry of the pack in indices and orLanes
+    size_t arity;      // Longest rule of the pack
+    int uniformOutput; // Output of all the lanes, -1 if they differ
+  };
+
+  vector<Pack> packs;         // Packs of rules
+  vector<int32_t> indices;    // Term index of every position and lane
+  vector<int64_t> orLanes;    // ~0 where a lane applies OR, else 0
+  vector<int32_t> outputs;    // Output of every lane, -1 if unused
+  size_t termCount = 0;       // Number of terms of the model
+  size_t outputCount = 0;     // Number of output sets
+  vector<double> degrees;     // Term degrees followed by 1 and 0
+
+public:
+  // Method to build the packs from the compiled rules
+  void compile(const FlatRuleBase &model)
+  {
+    packs.clear();
+    indices.clear();
+    orLanes.clear();
+    outputs.clear();
+    termCount = model.termNames.size();
+    outputCount = model.outputNames.size();
+    degrees.assign(termCount + 2, 0);
+    const int32_t ONE = termCount, ZERO = termCount + 1;
+
+    // Rules of the same output and length end up in the same packs
+    vector<unsigned> order(model.ruleCount());
+    for (size_t r = 0; r < order.size(); r++)
+      order[r] = r;
+    stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b)
+                {
+                  if (model.ruleOutput[a] != model.ruleOutput[b])
+                    return model.ruleOutput[a] < model.ruleOutput[b];
+                  return model.ruleStart[a + 1] - model.ruleStart[a] <
+                         model.ruleStart[b + 1] - model.ruleStart[b];
+                });
+
+    for (size_t first = 0; first < order.size(); first += RULE_PACK)
+    {
+      size_t lanes = min(RULE_PACK, order.size() - first);
+      Pack pack = {indices.size(), 1, (int)model.ruleOutput[order[first]]};
+      for (size_t l = 0; l < lanes; l++)
+      {
+        unsigned r = order[first + l];
+        pack.arity = max(pack.arity, model.ruleStart[r + 1] - model.ruleStart[r]);
+        if ((int)model.ruleOutput[r] != pack.uniformOutput)
+          pack.uniformOutput = -1;
+      }
+
+      indices.resize(indices.size() + pack.arity * RULE_PACK, ONE);
+      orLanes.resize(orLanes.size() + pack.arity * RULE_PACK, 0);
+      for (size_t l = 0; l < RULE_PACK; l++)
+      {
+        if (l >= lanes)
+        {
+          indices[pack.offset + l] = ZERO;
+          outputs.push_back(-1);
+          continue;
+        }
+
+        unsigned r = order[first + l];
+        for (size_t a = model.ruleStart[r]; a < model.ruleStart[r + 1]; a++)
+        {
+          size_t entry = pack.offset + (a - model.ruleStart[r]) * RULE_PACK + l;
+          indices[entry] = model.ruleTerms[a];
+          orLanes[entry] = a > model.ruleStart[r] && model.ruleOps[a] == OR_OP ? ~0LL : 0;
+        }
+        outputs.push_back(model.ruleOutput[r]);
+      }
+      packs.push_back(pack);
+    }
+  }
+
+  // Method to perform Mamdani inference for one input
+  // Takes the degree of every term of the compiled model and stores the
+  // activation of every output set in outputDegrees
+  void infer(const double *termDegrees, double *outputDegrees)
+  {
+    copy(termDegrees, termDegrees + termCount, degrees.begin());
+    degrees[termCount] = 1;
+    degrees[termCount + 1] = 0;
+    fill(outputDegrees, outputDegrees + outputCount, 0.0);
+
+    const double *base = degrees.data();
+    double strengths[RULE_PACK];
+    for (size_t p = 0; p < packs.size(); p++)
+    {
+      const Pack &pack = packs[p];
+      const int32_t *idx = &indices[pack.offset];
+      const int64_t *ors = &orLanes[pack.offset];
+
+#if defined(__AVX512F__)
+      for (size_t v = 0; v < RULE_PACK; v += 8)
+      {
+        __m512d acc = _mm512_i32gather_pd(_mm256_loadu_si256((const __m256i *)(idx + v)), base, 8);
+        for (size_t a = 1; a < pack.arity; a++)
+        {
+          size_t entry = a * RULE_PACK + v;
+          __m512d term = _mm512_i32gather_pd(_mm256_loadu_si256((const __m256i *)(idx + entry)), base, 8);
+          __m512i lanes = _mm512_loadu_si512((const void *)(ors + entry));
+          __mmask8 orMask = _mm512_test_epi64_mask(lanes, lanes);
+          acc = _mm512_mask_blend_pd(orMask, _mm512_min_pd(term, acc), _mm512_max_pd(term, acc));
+        }
+        _mm512_storeu_pd(strengths + v, acc);
+      }
+#elif defined(__AVX2__)
+      for (size_t v = 0; v < RULE_PACK; v += 4)
+      {
+        __m256d acc = _mm256_i32gather_pd(base, _mm_loadu_si128((const __m128i *)(idx + v)), 8);
+        for (size_t a = 1; a < pack.arity; a++)
+        {
+          size_t entry = a * RULE_PACK + v;
+          __m256d term = _mm256_i32gather_pd(base, _mm_loadu_si128((const __m128i *)(idx + entry)), 8);
+          __m256d orMask = _mm256_castsi256_pd(_mm256_loadu_si256((const __m256i *)(ors + entry)));
+          acc = _mm256_blendv_pd(_mm256_min_pd(term, acc), _mm256_max_pd(term, acc), orMask);
+        }
+        _mm256_storeu_pd(strengths + v, acc);
+      }
+#else
+      for (size_t l = 0; l < RULE_PACK; l++)
+        strengths[l] = base[idx[l]];
+      for (size_t a = 1; a < pack.arity; a++)
+        for (size_t l = 0; l < RULE_PACK; l++)
+        {
+          size_t entry = a * RULE_PACK + l;
+          double term = base[idx[entry]];
+          strengths[l] = ors[entry] ? fOr(term, strengths[l]) : fAnd(term, strengths[l]);
+        }
+#endif
+
+      // Max-scatter into the output activations
+      const int32_t *out = &outputs[p * RULE_PACK];
+      if (pack.uniformOutput >= 0)
+      {
+        double strongest = fOr(strengths, RULE_PACK);
+        outputDegrees[pack.uniformOutput] = fOr(outputDegrees[pack.uniformOutput], strongest);
+      }
+      else
+      {
+        for (size_t l = 0; l < RULE_PACK; l++)
+          if (out[l] >= 0)
+            outputDegrees[out[l]] = fOr(outputDegrees[out[l]], strengths[l]);
+      }
+    }
+  }
+};
+
+/******* Batch Inference *******/
+// Class to run the crisp Mamdani pipeline over batches of input rows
+// Rows are stored one after the other, inputCount values per row, and the
+// crisp outputs are returned in the same order.
+//
+// Offline batches often repeat rows, so by default identical rows (equal
+// bit patterns) are hashed together, inferred once and the result is
+// scattered back to every copy. The hashing is abandoned, and the rest of
+// the batch inferred without it, as soon as the distinct rows seen exceed
+// maxDistinctRatio of the rows processed, since deduplication then costs
+// more than it saves.
+//
+// With region grouping enabled, the rows are bucketed by the region of the
+// input space they fall in: for every input, the segment between two
+// consecutive breakpoints of its membership functions (or a breakpoint
+// itself). Rows of the same region fire the same set of rules, so each
+// bucket is evaluated with its fixed list of active rules over blocks of
+// ROW_BLOCK rows whose degrees are stored row-interleaved
+class BatchEngine
+{
+private:
+  FlatRuleBase model;               // Compiled rules
+  vector<OutputFuzzySet> outputSets; // Output sets for defuzzification
+  bool deduplicate = true;          // Whether identical rows are merged
+  double maxDistinctRatio = 0.9;    // Distinct/processed ratio to give up
+  bool groupRegions = false;        // Whether rows are bucketed by region
+  vector<vector<double>> breakpoints; // Sorted breakpoints of every input
+  vector<char> smoothTerms;         // Terms that are not piecewise linear
+  map<vector<size_t>, vector<unsigned>> regionRules; // Active rules
+  vector<unsigned> allRules;        // Every rule, for ungrouped blocks
+  RuleGatherKernel gatherKernel;    // Rule packs for single rows
+  size_t lastInferences = 0;        // Rows inferred by the last batch
+  size_t lastRegions = 0;           // Regions met by the last batch
+  vector<double> termDegrees;       // Scratch membership degrees
+  vector<double> outputDegrees;     // Scratch output activations
+
+  // Helper to get the segment of an input value
+  // Segment 2i is the open interval before breakpoint i and segment 2i + 1
+  // the breakpoint itself, so ids go from 0 to 2 * breakpoints
+  size_t segmentOf(size_t input, double x) const
+  {
+    const vector<double> &points = breakpoints[input];
+    size_t below = lower_bound(points.begin(), points.end(), x) - points.begin();
+    if (below < points.size() && points[below] == x)
+      return 2 * below + 1;
+    return 2 * below;
+  }
+
+  // Helper to get a value that lies inside a segment of an input
+  double segmentPoint(size_t input, size_t segment) const
+  {
+    const vector<double> &points = breakpoints[input];
+    if (points.empty())
+      return 0;
+    if (segment % 2 == 1)
+      return points[segment / 2];
+    size_t after = segment / 2;
+    if (after == 0)
+      return points.front() - 1;
+    if (after == points.size())
+      return points.back() + 1;
+    return (points[after - 1] + points[after]) / 2;
+  }
+
+  // Helper to get the rules that can fire in a region
+  // Inside a segment the piecewise linear memberships are either 0
+  // everywhere or nowhere, so one point per segment decides which terms
+  // are non zero, and a rule can fire if its connectives let a non zero
+  // value through. Other terms (Gaussians) can be 0 at the sampled point
+  // and not elsewhere in the segment, so they always count as non zero
+  const vector<unsigned> &activeRules(const vector<size_t> &segments)
+  {
+    auto found = regionRules.find(segments);
+    if (found != regionRules.end())
+      return found->second;
+
+    vector<double> point(model.inputCount);
+    for (size_t i = 0; i < model.inputCount; i++)
+      point[i] = segmentPoint(i, segments[i]);
+    vector<double> degrees(model.termNames.size());
+    model.fuzzify(point.data(), degrees.data());
+    for (size_t t = 0; t < degrees.size(); t++)
+      if (smoothTerms[t])
+        degrees[t] = 1;
+
+    vector<unsigned> &rules = regionRules[segments];
+    for (size_t r = 0; r < model.ruleCount(); r++)
+    {
+      bool nonZero = degrees[model.ruleTerms[model.ruleStart[r]]] > 0;
+      for (size_t a = model.ruleStart[r] + 1; a < model.ruleStart[r + 1]; a++)
+      {
+        bool term = degrees[model.ruleTerms[a]] > 0;
+        nonZero = model.ruleOps[a] == AND_OP ? nonZero && term : nonZero || term;
+      }
+      if (nonZero)
+        rules.push_back(r);
+    }
+    return rules;
+  }
+
+  // Helper to evaluate up to ROW_BLOCK rows with a fixed rule list
+  // Degrees and activations are stored row-interleaved, [item][lane], so
+  // the kernel only performs contiguous loads. Unused lanes stay at 0
+  void inferBlock(const vector<double> &rows, const size_t *blockRows,
+                  size_t lanes, const vector<unsigned> &rules, double *results)
+  {
+    size_t width = model.inputCount;
+    size_t terms = model.termNames.size();
+    size_t outputs = model.outputNames.size();
+    vector<double> degrees(terms * ROW_BLOCK, 0);
+    vector<double> activation(outputs * ROW_BLOCK, 0);
+
+    // Fuzzify the rows of the block
+    for (size_t t = 0; t < terms; t++)
+    {
+      if (model.termInput[t] < 0)
+        continue;
+      for (size_t l = 0; l < lanes; l++)
+        degrees[t * ROW_BLOCK + l] =
+            model.termSets[t].eval(rows[blockRows[l] * width + model.termInput[t]]);
+    }
+
+    // Evaluate every active rule on all the lanes at once
+    evaluateRowBlock(model, degrees.data(), rules, activation.data());
+
+    // Defuzzify every lane
+    vector<double> laneActivation(outputs);
+    for (size_t l = 0; l < lanes; l++)
+    {
+      for (size_t k = 0; k < outputs; k++)
+        laneActivation[k] = activation[k * ROW_BLOCK + l];
+      results[l] = defuzzifyCentroid(outputSets, laneActivation.data());
+    }
+  }
+
+  // Helper to infer a list of rows bucketed by region
+  // results[j] receives the output of rows[work[j]]
+  void inferGrouped(const vector<double> &rows, const vector<size_t> &work,
+                    double *results)
+  {
+    size_t width = model.inputCount;
+    size_t count = work.size();
+
+    // Segment of every row in every input
+    vector<size_t> segments(count * width);
+    vector<size_t> radix(width);
+    for (size_t i = 0; i < width; i++)
+      radix[i] = 2 * breakpoints[i].size() + 2;
+    for (size_t j = 0; j < count; j++)
+      for (size_t i = 0; i < width; i++)
+        segments[j * width + i] = segmentOf(i, rows[work[j] * width + i]);
+
+    // LSD radix sort of the positions by their segments, last input first
+    vector<size_t> order(count), sorted(count);
+    for (size_t j = 0; j < count; j++)
+      order[j] = j;
+    for (size_t i = width; i-- > 0;)
+    {
+      vector<size_t> start(radix[i] + 1, 0);
+      for (size_t j = 0; j < count; j++)
+        start[segments[j * width + i] + 1]++;
+      for (size_t b = 1; b < start.size(); b++)
+        start[b] += start[b - 1];
+      for (size_t j : order)
+        sorted[start[segments[j * width + i]]++] = j;
+      swap(order, sorted);
+    }
+
+    // Evaluate every bucket of equal segments in blocks of rows
+    lastRegions = 0;
+    vector<size_t> blockRows(ROW_BLOCK);
+    double blockResults[ROW_BLOCK];
+    for (size_t begin = 0; begin < count;)
+    {
+      const size_t *seg = &segments[order[begin] * width];
+      size_t end = begin + 1;
+      while (end < count && equal(seg, seg + width, &segments[order[end] * width]))
+        end++;
+
+      const vector<unsigned> &rules =
+          activeRules(vector<size_t>(seg, seg + width));
+      for (size_t b = begin; b < end; b += ROW_BLOCK)
+      {
+        size_t lanes = min(ROW_BLOCK, end - b);
+        for (size_t l = 0; l < lanes; l++)
+          blockRows[l] = work[order[b + l]];
+        inferBlock(rows, blockRows.data(), lanes, rules, blockResults);
+        for (size_t l = 0; l < lanes; l++)
+          results[order[b + l]] = blockResults[l];
+      }
+
+      lastRegions++;
+      begin = end;
+    }
+  }
+
+public:
+  // Constructor that compiles the rules against the fuzzy sets
+  // inputCount is the number of crisp inputs of a row (0 takes it from
+  // the declared input variables)
+  BatchEngine(const vector<InputFuzzySet> &inputSets, const Rules &rules,
+              const vector<OutputFuzzySet> &outputs, size_t inputCount = 0)
+      : outputSets(outputs)
+  {
+    model.compile(inputSets, rules, outputSets, inputCount);
+    termDegrees.resize(model.termNames.size());
+    outputDegrees.resize(model.outputNames.size());
+    for (size_t r = 0; r < model.ruleCount(); r++)
+      allRules.push_back(r);
+    gatherKernel.compile(model);
+
+    // Breakpoints of the piecewise linear memberships of every input
+    // Gaussian memberships add none; their rules are kept in every region
+    breakpoints.resize(model.inputCount);
+    smoothTerms.assign(model.termSets.size(), 0);
+    for (size_t t = 0; t < model.termSets.size(); t++)
+    {
+      if (model.termInput[t] < 0)
+        continue;
+      if (model.termSets[t].getType() == GAUSS)
+      {
+        smoothTerms[t] = 1;
+        continue;
+      }
+      for (double p : model.termSets[t].getParams())
+        breakpoints[model.termInput[t]].push_back(p);
+    }
+    for (auto &points : breakpoints)
+    {
+      sort(points.begin(), points.end());
+      points.erase(unique(points.begin(), points.end()), points.end());
+    }
+  }
+
+  // Method to enable or disable the deduplication of identical rows
+  void setDeduplication(bool enabled, double distinctRatio = 0.9)
+  {
+    deduplicate = enabled;
+    maxDistinctRatio = distinctRatio;
+  }
+
+  // Method to enable or disable the bucketing of rows by region
+  void setRegionGrouping(bool enabled) { groupRegions = enabled; }
+
+  // Method to get the number of rows actually inferred by the last batch
+  size_t getLastInferences() const { return lastInferences; }
+
+  // Method to get the number of regions met by the last grouped batch
+  size_t getLastRegions() const { return lastRegions; }
+
+  // Method to infer the crisp output of one row
+  // The rules are evaluated RULE_PACK at a time by the gather kernel
+  double inferRow(const double *row)
+  {
+    model.fuzzify(row, termDegrees.data());
+    gatherKernel.infer(termDegrees.data(), outputDegrees.data());
+    return defuzzifyCentroid(outputSets, outputDegrees.data());
+  }
+
+  // Method to infer the crisp outputs of a batch of rows
+  vector<double> infer(const vector<double> &rows)
+  {
+    size_t width = model.inputCount;
+    size_t count = width ? rows.size() / width : 0;
+    vector<double> results(count);
+
+    // Rows to infer: the first row of each distinct group, then every row
+    // left after deduplication stopped (or all of them if disabled)
+    vector<size_t> work;
+    vector<size_t> rowGroup(count, (size_t)-1);
+    unordered_map<string, size_t> groups;
+    bool hashing = deduplicate && count > 1;
+
+    // Rows are checked in blocks so the ratio is measured on enough rows
+    const size_t CHECK_BLOCK = 4096;
+    size_t row = 0;
+    for (; hashing && row < count; row++)
+    {
+      string key((const char *)&rows[row * width], width * sizeof(double));
+      auto found = groups.find(key);
+      if (found == groups.end())
+      {
+        found = groups.insert(make_pair(key, work.size())).first;
+        work.push_back(row);
+      }
+      rowGroup[row] = found->second;
+
+      if ((row + 1) % CHECK_BLOCK == 0 &&
+          work.size() > maxDistinctRatio * (row + 1))
+        hashing = false; // Too many distinct rows, stop deduplicating
+    }
+    size_t hashedRows = row;
+    size_t groupCount = work.size();
+    for (; row < count; row++)
+      work.push_back(row);
+
+    // Infer the selected rows, in blocks of ROW_BLOCK rows with every rule
+    // unless they are grouped by region
+    vector<double> workResults(work.size());
+    if (groupRegions)
+      inferGrouped(rows, work, workResults.data());
+    else
+      for (size_t b = 0; b < work.size(); b += ROW_BLOCK)
+        inferBlock(rows, &work[b], min(ROW_BLOCK, work.size() - b), allRules,
+                   &workResults[b]);
+
+    // Scatter the results of the groups to every copy
+    for (size_t r = 0; r < hashedRows; r++)
+      results[r] = workResults[rowGroup[r]];
+    for (size_t j = groupCount; j < work.size(); j++)
+      results[work[j]] = workResults[j];
+
+    lastInferences = work.size();
+    return results;
+  }
+};
+
+// Function to read the rules from a file
+// Adds them to the Rules object
+// Takes the filename and the Rules object as arguments
+void readRulesFromFile(const std::string &filename, Rules &rules)
+{
+  // Open the file in read mode
+  std::ifstream file(filename);
+  // String used to store each line of the file
+  std::string rule;
+
+  // Check if the file was opened successfully
+  if (file.is_open())
+  {
+    // Read each line of the file and add it to the rule variable
+    while (std::getline(file, rule))
+    {
+      rules.addRule(rule); // Add the rule to the Rules object
+    }
+    // Close the file
+    file.close();
+
+    // Store complete grid rule bases as a dense tensor
+    rules.compileGrid();
+
+    // Report the memory used by the rule storage
+    if (rules.size() > 0)
+      std::cout << "Loaded " << rules.size() << " rules ("
+                << (rules.isGrid() ? "grid tensor" : "compact encoding")
+                << "): " << rules.storageBytes() << " bytes, "
+                << (double)rules.storageBytes() / rules.size()
+                << " bytes/rule" << std::endl;
+  }
+  else
+  {
+    std::cerr << "Error: Unable to open file " << filename << std::endl;
+  }
+}
+
+// Function to read rules that may use parentheses from a file
+// Compiles them into the antecedent DAG
+// Takes the filename and the RuleDag object as arguments
+void readRulesFromFile(const std::string &filename, RuleDag &dag)
+{
+  // Open the file in read mode
+  std::ifstream file(filename);
+  // String used to store each line of the file
+  std::string rule;
+
+  // Check if the file was opened successfully
+  if (file.is_open())
+  {
+    // Compile each non blank line of the file
+    while (std::getline(file, rule))
+    {
+      if (rule.find_first_not_of(" \t\r") != string::npos && !dag.addRule(rule))
+        std::cerr << "Warning: skipping malformed rule: " << rule << std::endl;
+    }
+    // Close the file
+    file.close();
+  }
+  else
+  {
+    std::cerr << "Error: Unable to open file " << filename << std::endl;
+  }
+}
+
+// Function to read the linguistic variables declared in a fuzzy set file
+// Lines "INPUT <name> [<low> <high>]" and "OUTPUT <name> [<low> <high>]"
+// declare a variable and its universe of discourse; the fuzzy sets that
+// follow, up to the next declaration, are its terms
+std::vector<LinguisticVariable> readLinguisticVariables(const std::string &filename)
+{
+  std::ifstream file(filename);
+  std::string line;
+  std::vector<LinguisticVariable> variables;
+  while (std::getline(file, line))
+  {
+    std::istringstream iss(line);
+    std::string key, name;
+    if (!(iss >> key >> name))
+      continue;
+
+    if (key == "INPUT" || key == "OUTPUT")
+    {
+      LinguisticVariable variable;
+      variable.name = name;
+      variable.output = key == "OUTPUT";
+      double low, high;
+      if (iss >> low >> high)
+      {
+        variable.low = low;
+        variable.high = high;
+      }
+      variables.push_back(variable);
+    }
+    else if (!variables.empty() && key != "NORMS" && key != "IMPLICATION" &&
+             key != "AGGREGATION")
+      variables.back().terms.push_back(key);
+  }
+  return variables;
+}
+
+// Function to read the names of the output variables from a file
+// Returns the declared output variables in order, or {"Tip"} if the file
+// declares none, as in the tipping model
+std::vector<std::string> readOutputVariableNames(const std::string &filename)
+{
+  std::vector<std::string> names;
+  for (const auto &variable : readLinguisticVariables(filename))
+    if (variable.output)
+      names.push_back(variable.name);
+  if (names.empty())
+    names.push_back("Tip");
+  return names;
+}
+
+// Function to read the fuzzy sets from a file
+// Initializes them in vectors of fuzzy sets
+// Takes the filename as an argument
 // And the vectors of input and output fuzzy sets
+// Sets that follow an INPUT or OUTPUT declaration belong to that variable;
+// in files without declarations, output sets are the ones named after an
+// output variable
 void readFuzzySetsFromFile(const std::string &filename,
                            std::vector<InputFuzzySet> &inputSets,
                            std::vector<OutputFuzzySet> &outputSets)
 {
+  std::vector<std::string> outputVariables = readOutputVariableNames(filename);
+
+  // Variable declared by the last INPUT or OUTPUT line
+  std::string variableName;
+  bool outputVariable = false;
+  int inputCount = 0, outputCount = 0;
+
   // Open the file in read mode
   std::ifstream file(filename);
   std::string line;
@@ -512,6 +5576,18 @@ void readFuzzySetsFromFile(const std::string &filename,
   {
     // Create an input stream from the read line for processing
     std::istringstream iss(line);
+
+    // Declarations of linguistic variables start a new variable
+    std::string key, name;
+    std::istringstream declaration(line);
+    if (declaration >> key >> name && (key == "INPUT" || key == "OUTPUT"))
+    {
+      variableName = name;
+      outputVariable = key == "OUTPUT";
+      (outputVariable ? outputCount : inputCount)++;
+      continue;
+    }
+
     // Declare variables to store the values
     std::string setName, mfTypeStr;
     double param1, param2, param3, param4;
@@ -532,6 +5608,8 @@ void readFuzzySetsFromFile(const std::string &filename,
         numParams = 2;
       else if (mfTypeStr == "GAUSS")
         numParams = 2;
+      else if (mfTypeStr == "SINGLETON")
+        numParams = 1;
 
       // Switch to process different numbers of parameters
       switch (numParams)
@@ -561,6 +5639,9 @@ void readFuzzySetsFromFile(const std::string &filename,
           break;
         }
         break;
+      case 1:
+        params.push_back(param1);
+        break;
       case 2:
         if (iss >> param2)
         {
@@ -583,14 +5664,19 @@ void readFuzzySetsFromFile(const std::string &filename,
         mfType = SAT;
       else if (mfTypeStr == "GAUSS")
         mfType = GAUSS;
+      else if (mfTypeStr == "SINGLETON")
+        mfType = SINGLETON;
 
-      // Check if the fuzzy set name contains "Tip"
+      // Check if the fuzzy set belongs to an output variable
       // To determine if it is an input or output set
-      if (setName.find("Tip") != std::string::npos)
+      bool declared = !variableName.empty();
+      if (declared ? outputVariable : variableOf(setName, outputVariables) >= 0)
       {
         // Create a new output set and add it to the vector
         OutputFuzzySet outputSet(setName);
         outputSet.setMF(mfType, params);
+        if (declared)
+          outputSet.setVariable(outputCount - 1, variableName);
         outputSets.push_back(outputSet);
       }
       else // Input fuzzy set
@@ -598,13 +5684,655 @@ void readFuzzySetsFromFile(const std::string &filename,
         // Create a new input set and add it to the vector
         InputFuzzySet inputSet(setName);
         inputSet.setMF(mfType, params);
+        if (declared)
+          inputSet.setVariable(inputCount - 1, variableName);
         inputSets.push_back(inputSet);
       }
     }
   }
 }
-int main()
+
+// Function to read the operators of a fuzzy system from a model file
+// Lines "NORMS <ZADEH|PRODUCT|LUKASIEWICZ|HAMACHER|EINSTEIN>",
+// "IMPLICATION <MIN|PRODUCT>", "AGGREGATION <MAX|SUM|BOUNDED_SUM|PROBOR>" and
+// "REDUCTION <FAST|DETERMINISTIC>" set the policy; other lines are ignored
+// Returns false if the file cannot be opened
+bool readInferencePolicy(const std::string &filename, InferencePolicy &policy)
+{
+  std::ifstream file(filename);
+  if (!file.is_open())
+    return false;
+
+  std::string line;
+  while (std::getline(file, line))
+  {
+    std::istringstream iss(line);
+    std::string key, value;
+    if (!(iss >> key >> value))
+      continue;
+
+    if (key == "NORMS")
+    {
+      if (value == "ZADEH")
+        policy.norms = ZADEH_NORMS;
+      else if (value == "PRODUCT")
+        policy.norms = PRODUCT_NORMS;
+      else if (value == "LUKASIEWICZ")
+        policy.norms = LUKASIEWICZ_NORMS;
+      else if (value == "HAMACHER")
+        policy.norms = HAMACHER_NORMS;
+      else if (value == "EINSTEIN")
+        policy.norms = EINSTEIN_NORMS;
+      else
+        std::cerr << "Warning: unknown norms " << value << std::endl;
+    }
+    else if (key == "IMPLICATION")
+    {
+      if (value == "MIN")
+        policy.implication = MIN_IMPLICATION;
+      else if (value == "PRODUCT")
+        policy.implication = PRODUCT_IMPLICATION;
+      else
+        std::cerr << "Warning: unknown implication " << value << std::endl;
+    }
+    else if (key == "AGGREGATION")
+    {
+      if (value == "MAX")
+        policy.aggregation = MAX_AGGREGATION;
+      else if (value == "SUM")
+        policy.aggregation = SUM_AGGREGATION;
+      else if (value == "BOUNDED_SUM")
+        policy.aggregation = BOUNDED_SUM_AGGREGATION;
+      else if (value == "PROBOR")
+        policy.aggregation = PROBOR_AGGREGATION;
+      else
+        std::cerr << "Warning: unknown aggregation " << value << std::endl;
+    }
+    else if (key == "REDUCTION")
+    {
+      if (value == "FAST")
+        policy.reduction = FAST_REDUCTION;
+      else if (value == "DETERMINISTIC")
+        policy.reduction = DETERMINISTIC_REDUCTION;
+      else
+        std::cerr << "Warning: unknown reduction " << value << std::endl;
+    }
+  }
+  return true;
+}
+
+// Function to read a hierarchical fuzzy system from a model file
+// Lines "INPUT <name>" declare the crisp inputs and lines
+// "STAGE <name> <fuzzy set file> <rule file> <input>..." add a stage whose
+// output variables are the ones declared in its fuzzy set file. Files are
+// relative to the model file, and inputs written "~V" are fuzzy links
+// Returns false if the file cannot be opened or a stage cannot be added
+bool readHierarchyFromFile(const std::string &filename, HierarchicalSystem &system)
+{
+  std::ifstream file(filename);
+  if (!file.is_open())
+  {
+    std::cerr << "Error: Unable to open file " << filename << std::endl;
+    return false;
+  }
+
+  // Directory of the model file
+  std::string directory = filename.substr(0, filename.find_last_of('/') + 1);
+
+  std::string line;
+  while (std::getline(file, line))
+  {
+    std::istringstream iss(line);
+    std::string key, name;
+    if (!(iss >> key >> name))
+      continue;
+
+    if (key == "INPUT")
+    {
+      if (!system.addInput(name))
+        return false;
+    }
+    else if (key == "STAGE")
+    {
+      std::string setsFile, rulesFile, input;
+      std::vector<std::string> inputs;
+      if (!(iss >> setsFile >> rulesFile))
+      {
+        std::cerr << "Warning: malformed stage: " << line << std::endl;
+        return false;
+      }
+      while (iss >> input)
+        inputs.push_back(input);
+
+      std::vector<InputFuzzySet> inputSets;
+      std::vector<OutputFuzzySet> outputSets;
+      Rules rules;
+      readFuzzySetsFromFile(directory + setsFile, inputSets, outputSets);
+      readRulesFromFile(directory + rulesFile, rules);
+      std::vector<OutputVariable> variables =
+          groupOutputSets(outputSets, readOutputVariableNames(directory + setsFile));
+      if (!system.addStage(name, inputSets, rules, variables, inputs))
+        return false;
+    }
+  }
+  return true;
+}
+
+/******* Benchmarks *******/
+// Function to time a callable
+// Runs f repeatedly for at least minSeconds and returns the mean seconds
+// per call
+template <class F>
+double timeIt(F f, double minSeconds = 0.2)
+{
+  size_t calls = 0;
+  auto start = chrono::steady_clock::now();
+  double elapsed = 0;
+  do
+  {
+    f();
+    calls++;
+    elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  } while (elapsed < minSeconds);
+  return elapsed / calls;
+}
+
+// Function to benchmark the n-ary AND/OR reductions
+// Reports the bandwidth reached on spans that fit in cache and on spans
+// much larger than the caches
+void benchmarkNorms()
+{
+  cout << "\nN-ary norm reductions:" << endl;
+  for (size_t count : {(size_t)4096, (size_t)1 << 24})
+  {
+    vector<double> values(count);
+    for (size_t i = 0; i < count; i++)
+      values[i] = (double)((i * 7919) % 1000) / 1000;
+
+    volatile double sink = 0;
+    double andSeconds = timeIt([&]() { sink = fAnd(values.data(), count); });
+    double orSeconds = timeIt([&]() { sink = fOr(values.data(), count); });
+    double bytes = count * sizeof(double);
+    cout << "  " << count << " values: fAnd " << bytes / andSeconds / 1e9
+         << " GB/s, fOr " << bytes / orSeconds / 1e9 << " GB/s" << endl;
+  }
+}
+
+// Function to benchmark the streaming evaluation of a large encoded rule base
+// 10^7 random AND rules of 2 to 5 antecedents over 3000 terms and 64 output
+// sets. Reports the memory used per rule
+// and the rate at which the encoded stream is evaluated, next to a plain
+// sequential read of as many bytes
+void benchmarkRuleStreaming()
+{
+  const size_t RULES = 10000000, TERMS = 3000, OUTPUTS = 64;
+  CompactRuleStore store;
+  for (size_t t = 0; t < TERMS; t++)
+    store.addTerm("T" + to_string(t));
+  for (size_t k = 0; k < OUTPUTS; k++)
+    store.addOutput("O" + to_string(k));
+
+  uint64_t state = 12345;
+  auto next = [&](size_t range)
+  {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (size_t)((state >> 33) % range);
+  };
+  vector<unsigned> terms;
+  for (size_t r = 0; r < RULES; r++)
+  {
+    terms.resize(2 + next(4));
+    for (auto &term : terms)
+      term = next(TERMS);
+    store.add(terms, vector<RuleOp>(terms.size() - 1, AND_OP), next(OUTPUTS));
+  }
+
+  // Terms form strong partitions of 10 terms, so 2 of every 10 are non zero
+  vector<double> termDegrees(TERMS, 0);
+  for (size_t t = 0; t < TERMS; t += 10)
+  {
+    double degree = (double)next(1000) / 1000;
+    size_t first = t + next(9);
+    termDegrees[first] = degree;
+    termDegrees[first + 1] = 1 - degree;
+  }
+
+  vector<uint64_t> words(store.encodedBytes() / sizeof(uint64_t));
+  for (size_t i = 0; i < words.size(); i++)
+    words[i] = i;
+
+  vector<double> outputDegrees;
+  volatile double sink = 0;
+  double inferSeconds = timeIt([&]()
+                               { store.infer(termDegrees, outputDegrees);
+                                 sink = outputDegrees[0]; });
+  double readSeconds = timeIt([&]()
+                              { uint64_t sum = 0;
+                                for (uint64_t word : words) sum += word;
+                                sink = (double)sum; });
+
+  double bytes = store.encodedBytes();
+  cout << "\nStreaming " << RULES << " encoded rules:" << endl;
+  cout << "  " << bytes / RULES << " bytes/rule, " << bytes / 1e6 << " MB" << endl;
+  cout << "  Evaluation: " << bytes / inferSeconds / 1e9 << " GB/s, "
+       << inferSeconds / RULES * 1e9 << " ns/rule" << endl;
+  cout << "  Sequential read of the same bytes: " << bytes / readSeconds / 1e9
+       << " GB/s" << endl;
+}
+
+// Function to benchmark TSK inference against Mamdani inference on the
+// tipping model
+// Uses variables.txt, rules.txt and rules_tsk.txt from the working directory
+void benchmarkTsk()
+{
+  vector<InputFuzzySet> inputSets;
+  vector<OutputFuzzySet> outputSets;
+  readFuzzySetsFromFile("variables.txt", inputSets, outputSets);
+  Rules rulesMamdani, rulesTsk;
+  readRulesFromFile("rules.txt", rulesMamdani);
+  readRulesFromFile("rules_tsk.txt", rulesTsk);
+
+  TskEngine tsk(inputSets, rulesTsk);
+  unique_ptr<InferenceEngine> mamdani =
+      makeInferenceEngine(InferencePolicy(), inputSets, rulesMamdani, outputSets);
+  if (!tsk.isValid() || tsk.size() == 0)
+  {
+    cerr << "Error: rules_tsk.txt has no TSK rules" << endl;
+    return;
+  }
+
+  // Sweep the inputs over a grid so every rule fires at some point
+  vector<vector<double>> rows;
+  for (int service = 0; service <= 100; service += 5)
+    for (int food = 0; food <= 100; food += 5)
+      rows.push_back({(double)service, (double)food});
+
+  volatile double sink = 0;
+  double mapSeconds = timeIt([&]()
+                             { for (const auto &row : rows) sink = inferCrisp(inputSets, rulesMamdani, outputSets, row); });
+  double flatSeconds = timeIt([&]()
+                              { for (const auto &row : rows) sink = mamdani->infer(row); });
+  double tskSeconds = timeIt([&]()
+                             { for (const auto &row : rows) sink = tsk.infer(row); });
+
+  cout << "\nTipping model latency per inference:" << endl;
+  cout << "  Mamdani (inferCrisp): " << mapSeconds / rows.size() * 1e9 << " ns" << endl;
+  cout << "  Mamdani (PolicyEngine): " << flatSeconds / rows.size() * 1e9 << " ns" << endl;
+  cout << "  TSK: " << tskSeconds / rows.size() * 1e9 << " ns" << endl;
+}
+
+// Function to benchmark the fused defuzzification sweep against the
+// centroid alone on the output sets of variables.txt
+void benchmarkDefuzzifiers()
+{
+  vector<InputFuzzySet> inputSets;
+  vector<OutputFuzzySet> outputSets;
+  readFuzzySetsFromFile("variables.txt", inputSets, outputSets);
+
+  vector<double> activation(outputSets.size());
+  for (size_t k = 0; k < activation.size(); k++)
+    activation[k] = (double)(k + 1) / (activation.size() + 1);
+
+  Defuzzifier defuzzifier(outputSets);
+  volatile double sink = 0;
+  double centroidSeconds = timeIt([&]()
+                                  { sink = defuzzifyCentroid(outputSets, activation.data()); });
+  double fusedSeconds = timeIt([&]()
+                               { sink = defuzzifier.defuzzify(activation.data()).bisector; });
+
+  cout << "\nDefuzzification latency:" << endl;
+  cout << "  Centroid (defuzzifyCentroid): " << centroidSeconds * 1e9 << " ns" << endl;
+  cout << "  Centroid, bisector, MOM, SOM and LOM (Defuzzifier): "
+       << fusedSeconds * 1e9 << " ns" << endl;
+}
+
+// Function to benchmark the deterministic reduction mode against the fast
+// mode, for raw sums and for the engines that use them
+void benchmarkReductions()
+{
+  vector<InputFuzzySet> inputSets;
+  vector<OutputFuzzySet> outputSets;
+  readFuzzySetsFromFile("variables.txt", inputSets, outputSets);
+  Rules rulesMamdani, rulesTsk;
+  readRulesFromFile("rules.txt", rulesMamdani);
+  readRulesFromFile("rules_tsk.txt", rulesTsk);
+
+  vector<double> values(1 << 20), activation(outputSets.size(), 0.5);
+  for (size_t i = 0; i < values.size(); i++)
+    values[i] = (double)((i * 7919) % 1000) / 1000;
+  Defuzzifier fastDefuzzifier(outputSets);
+  Defuzzifier deterministicDefuzzifier(outputSets, DETERMINISTIC_REDUCTION);
+  TskEngine fastTsk(inputSets, rulesTsk);
+  TskEngine deterministicTsk(inputSets, rulesTsk, 2, DETERMINISTIC_REDUCTION);
+  InferencePolicy deterministicPolicy;
+  deterministicPolicy.reduction = DETERMINISTIC_REDUCTION;
+  unique_ptr<InferenceEngine> fastMamdani =
+      makeInferenceEngine(InferencePolicy(), inputSets, rulesMamdani, outputSets);
+  unique_ptr<InferenceEngine> deterministicMamdani =
+      makeInferenceEngine(deterministicPolicy, inputSets, rulesMamdani, outputSets);
+  vector<double> row = {40, 60};
+
+  volatile double sink = 0;
+  cout << "\nDeterministic reductions (fast / deterministic):" << endl;
+  auto compare = [&](const string &name, function<double()> runFast,
+                     function<double()> runDeterministic)
+  {
+    double fast = timeIt([&]()
+                         { sink = runFast(); });
+    double deterministic = timeIt([&]()
+                                  { sink = runDeterministic(); });
+    cout << "  " << name << ": " << fast * 1e9 << " ns / " << deterministic * 1e9
+         << " ns (" << (deterministic / fast - 1) * 100 << "% overhead)" << endl;
+  };
+
+  compare(
+      "Dot product of 1M values",
+      [&]()
+      { return dotProduct(values.data(), values.data(), values.size()); },
+      [&]()
+      { return reproducibleDot(values.data(), values.data(), values.size()); });
+  compare(
+      "defuzzifyCentroid",
+      [&]()
+      { return defuzzifyCentroid(outputSets, activation.data()); },
+      [&]()
+      { return defuzzifyCentroid(outputSets, activation.data(), nullptr,
+                                 DETERMINISTIC_REDUCTION); });
+  compare(
+      "Defuzzifier",
+      [&]()
+      { return fastDefuzzifier.defuzzify(activation.data()).centroid; },
+      [&]()
+      { return deterministicDefuzzifier.defuzzify(activation.data()).centroid; });
+  compare(
+      "PolicyEngine",
+      [&]()
+      { return fastMamdani->infer(row); },
+      [&]()
+      { return deterministicMamdani->infer(row); });
+  compare(
+      "TSK",
+      [&]()
+      { return fastTsk.infer(row); },
+      [&]()
+      { return deterministicTsk.infer(row); });
+}
+
+// Function to benchmark the fuzzification of the tipping model with its
+// membership functions against the membership tables
+void benchmarkMembershipTables()
+{
+  vector<InputFuzzySet> inputSets;
+  vector<OutputFuzzySet> outputSets;
+  readFuzzySetsFromFile("variables.txt", inputSets, outputSets);
+  Rules rules;
+  readRulesFromFile("rules.txt", rules);
+  FlatRuleBase model;
+  model.compile(inputSets, rules, outputSets, 2);
+
+  vector<LinguisticVariable> inputVariables;
+  for (const auto &variable : readLinguisticVariables("variables.txt"))
+    if (!variable.output)
+      inputVariables.push_back(variable);
+  TableFuzzifier<uint16_t> shortTables(model, inputVariables, {1, 1});
+  TableFuzzifier<float> floatTables(model, inputVariables, {1, 1});
+  TableFuzzifier<uint16_t> interpolatedTables(model, inputVariables, {1, 1}, true);
+
+  // Integer waiting times and prices
+  vector<double> rows;
+  for (int service = 0; service <= 100; service++)
+    for (int food = 0; food <= 100; food += 4)
+      rows.insert(rows.end(), {(double)service, (double)food});
+  size_t rowCount = rows.size() / 2;
+  vector<double> degrees(model.termNames.size());
+
+  volatile double sink = 0;
+  double directSeconds = timeIt([&]()
+                                { for (size_t r = 0; r < rowCount; r++) model.fuzzify(&rows[2 * r], degrees.data());
+                                  sink = degrees[0]; });
+  double shortSeconds = timeIt([&]()
+                               { for (size_t r = 0; r < rowCount; r++) shortTables.fuzzify(&rows[2 * r], degrees.data());
+                                 sink = degrees[0]; });
+  double floatSeconds = timeIt([&]()
+                               { for (size_t r = 0; r < rowCount; r++) floatTables.fuzzify(&rows[2 * r], degrees.data());
+                                 sink = degrees[0]; });
+  double interpolatedSeconds = timeIt([&]()
+                                      { for (size_t r = 0; r < rowCount; r++) interpolatedTables.fuzzify(&rows[2 * r], degrees.data());
+                                        sink = degrees[0]; });
+
+  cout << "\nFuzzification latency per row:" << endl;
+  cout << "  Membership functions: " << directSeconds / rowCount * 1e9 << " ns" << endl;
+  cout << "  uint16 tables (" << shortTables.bytes() << " bytes): " << shortSeconds / rowCount * 1e9 << " ns" << endl;
+  cout << "  float tables (" << floatTables.bytes() << " bytes): " << floatSeconds / rowCount * 1e9 << " ns" << endl;
+  cout << "  uint16 tables, interpolated: " << interpolatedSeconds / rowCount * 1e9 << " ns" << endl;
+}
+
+// Function to benchmark the hierarchical model in hierarchy/ with blocks of
+// rows pipelined through the stages against one row at a time
+void benchmarkHierarchy()
+{
+  HierarchicalSystem system;
+  if (!readHierarchyFromFile("hierarchy/model.txt", system))
+    return;
+
+  vector<double> rows;
+  for (int i = 0; i < 4096; i++)
+    for (size_t k = 0; k < system.inputCount(); k++)
+      rows.push_back((i * 37 + k * 11) % 101 / 10.0);
+  size_t rowCount = rows.size() / system.inputCount();
+  vector<double> outputs(rowCount * system.outputCount());
+
+  double rowSeconds = timeIt([&]()
+                             { for (size_t r = 0; r < rowCount; r++)
+                                 system.inferBatch(&rows[r * system.inputCount()], 1,
+                                                   &outputs[r * system.outputCount()]); });
+  double blockSeconds = timeIt([&]()
+                               { system.inferBatch(rows.data(), rowCount, outputs.data()); });
+
+  cout << "\nHierarchical model (" << system.stageCount() << " stages) latency per row:" << endl;
+  cout << "  Row at a time: " << rowSeconds / rowCount * 1e9 << " ns" << endl;
+  cout << "  Pipelined blocks of " << HIERARCHY_BLOCK << ": " << blockSeconds / rowCount * 1e9 << " ns" << endl;
+}
+
+// Function to report the deviation of the fixed-point engine from the
+// double engine on a dense sweep of the tipping model, and to benchmark
+// both
+void benchmarkFixedPoint()
+{
+  vector<InputFuzzySet> inputSets;
+  vector<OutputFuzzySet> outputSets;
+  readFuzzySetsFromFile("variables.txt", inputSets, outputSets);
+  Rules rules;
+  readRulesFromFile("rules.txt", rules);
+  FixedPointEngine fixedEngine(inputSets, rules, outputSets);
+  unique_ptr<InferenceEngine> doubleEngine =
+      makeInferenceEngine(InferencePolicy(), inputSets, rules, outputSets);
+
+  // Sweep past both ends of the universes with a step that is not a
+  // multiple of the Q16.16 resolution
+  vector<double> rows;
+  vector<Fixed> fixedRows;
+  for (double service = -10; service <= 110; service += 0.37)
+    for (double food = -10; food <= 110; food += 0.37)
+    {
+      rows.insert(rows.end(), {service, food});
+      fixedRows.insert(fixedRows.end(), {toFixed(service), toFixed(food)});
+    }
+  size_t rowCount = rows.size() / 2;
+
+  double maxDeviation = 0, sumDeviation = 0;
+  for (size_t r = 0; r < rowCount; r++)
+  {
+    double deviation = fabs(fromFixed(fixedEngine.infer(&fixedRows[2 * r])) -
+                            doubleEngine->infer(&rows[2 * r]));
+    maxDeviation = max(maxDeviation, deviation);
+    sumDeviation += deviation;
+  }
+
+  volatile double sink = 0;
+  double doubleSeconds = timeIt([&]()
+                                { for (size_t r = 0; r < rowCount; r++) sink = doubleEngine->infer(&rows[2 * r]); });
+  double fixedSeconds = timeIt([&]()
+                               { for (size_t r = 0; r < rowCount; r++) sink = fixedEngine.infer(&fixedRows[2 * r]); });
+
+  // Gaussians from very narrow to wide over the whole Q16.16 range
+  double gaussDeviation = 0;
+  size_t gaussSamples = 0;
+  for (double width : {0.0001, 0.01, 1.0, 100.0, 1e6})
+  {
+    vector<double> params = {0, width};
+    InputFuzzySet gauss("Gauss");
+    gauss.setMF(GAUSS, params);
+    FixedMembership fixedGauss(GAUSS, params);
+    for (double x = -32767; x <= 32767; x += 0.37 * sqrt(width) + 0.01)
+    {
+      gaussDeviation = max(gaussDeviation, fabs(fixedGauss.eval(toFixed(x)) / (double)MEMBERSHIP_ONE -
+                                                gauss.eval(fromFixed(toFixed(x)))));
+      gaussSamples++;
+    }
+  }
+
+  cout << "\nFixed-point engine (Q16.16 values, Q15 memberships) over " << rowCount << " rows:" << endl;
+  cout << "  Deviation from double: max " << maxDeviation << ", mean " << sumDeviation / rowCount << endl;
+  cout << "  Gaussian memberships: max deviation " << gaussDeviation << " over "
+       << gaussSamples << " points" << endl;
+  cout << "  Double: " << rowCount / doubleSeconds << " inferences/s" << endl;
+  cout << "  Fixed point: " << rowCount / fixedSeconds << " inferences/s" << endl;
+}
+
+// Function to report the precision and the throughput of the engine
+// instantiations on a dense sweep of the tipping model, against the double
+// instantiation
+void benchmarkPrecision()
+{
+  vector<InputFuzzySet> inputSets;
+  vector<OutputFuzzySet> outputSets;
+  readFuzzySetsFromFile("variables.txt", inputSets, outputSets);
+  Rules rules;
+  readRulesFromFile("rules.txt", rules);
+  ScalarEngine<double> doubleEngine(inputSets, rules, outputSets);
+  ScalarEngine<float> floatEngine(inputSets, rules, outputSets);
+  ScalarEngine<float, float, double> mixedEngine(inputSets, rules, outputSets);
+  ScalarEngine<float, BFloat16, double> bfloatEngine(inputSets, rules, outputSets);
+
+  vector<double> rows;
+  vector<float> floatRows;
+  for (double service = -10; service <= 110; service += 0.37)
+    for (double food = -10; food <= 110; food += 0.37)
+    {
+      rows.insert(rows.end(), {service, food});
+      floatRows.insert(floatRows.end(), {(float)service, (float)food});
+    }
+  size_t rowCount = rows.size() / 2;
+
+  vector<double> reference(rowCount);
+  for (size_t r = 0; r < rowCount; r++)
+    reference[r] = doubleEngine.infer(&rows[2 * r]);
+
+  cout << "\nPrecision of the engine instantiations over " << rowCount << " rows:" << endl;
+  volatile double sink = 0;
+  auto report = [&](const string &name, function<double(size_t)> infer)
+  {
+    double maxDeviation = 0, sumDeviation = 0;
+    for (size_t r = 0; r < rowCount; r++)
+    {
+      double deviation = fabs(infer(r) - reference[r]);
+      maxDeviation = max(maxDeviation, deviation);
+      sumDeviation += deviation;
+    }
+    double seconds = timeIt([&]()
+                            { for (size_t r = 0; r < rowCount; r++) sink = infer(r); });
+    cout << "  " << name << ": max deviation " << maxDeviation << ", mean "
+         << sumDeviation / rowCount << ", " << rowCount / seconds << " inferences/s" << endl;
+  };
+  report("double", [&](size_t r)
+         { return doubleEngine.infer(&rows[2 * r]); });
+  report("float", [&](size_t r)
+         { return (double)floatEngine.infer(&floatRows[2 * r]); });
+  report("float, double sums", [&](size_t r)
+         { return mixedEngine.infer(&floatRows[2 * r]); });
+  report("bfloat16 shapes, double sums", [&](size_t r)
+         { return bfloatEngine.infer(&floatRows[2 * r]); });
+}
+
+// Function to run all the benchmarks
+int runBenchmarks()
+{
+  benchmarkNorms();
+  benchmarkRuleStreaming();
+  benchmarkTsk();
+  benchmarkDefuzzifiers();
+  benchmarkReductions();
+  benchmarkHierarchy();
+  benchmarkMembershipTables();
+  benchmarkFixedPoint();
+  benchmarkPrecision();
+  return 0;
+}
+
+// Function to record the selectivity profile of the tipping model
+// trafficFile holds one row of crisp inputs per line, in the order of the
+// inputs. The memberships of every row are added to selectivity.txt, which
+// the example loads to reorder the antecedents of the rules
+int recordSelectivity(const string &trafficFile)
+{
+  ifstream file(trafficFile);
+  if (!file.is_open())
+  {
+    cerr << "Error: cannot open " << trafficFile << endl;
+    return 1;
+  }
+
+  vector<InputFuzzySet> inputSets;
+  vector<OutputFuzzySet> outputSets;
+  readFuzzySetsFromFile("variables.txt", inputSets, outputSets);
+
+  // Keep adding to the profile already saved with the model
+  SelectivityProfile profile;
+  profile.load("selectivity.txt");
+
+  size_t rowCount = 0;
+  string line;
+  while (getline(file, line))
+  {
+    istringstream iss(line);
+    vector<double> inputs;
+    double value;
+    while (iss >> value)
+      inputs.push_back(value);
+    if (inputs.empty())
+      continue;
+
+    map<string, double> inputMembershipValues;
+    for (const auto &inputSet : inputSets)
+    {
+      int input = inputIndexOf(inputSet);
+      if (input >= 0 && (size_t)input < inputs.size())
+        inputMembershipValues[inputSet.getName()] = inputSet.eval(inputs[input]);
+    }
+    profile.record(inputMembershipValues);
+    rowCount++;
+  }
+
+  if (!profile.save("selectivity.txt"))
+  {
+    cerr << "Error: cannot write selectivity.txt" << endl;
+    return 1;
+  }
+  cout << "Recorded " << rowCount << " rows into selectivity.txt" << endl;
+  return 0;
+}
+
+int main(int argc, char *argv[])
 {
+  // Run the benchmarks instead of the example when asked to
+  if (argc > 1 && string(argv[1]) == "--bench")
+    return runBenchmarks();
+
+  // Record the selectivity profile from a file of input rows when asked to
+  if (argc > 2 && string(argv[1]) == "--profile")
+    return recordSelectivity(argv[2]);
+
   // Crisp values for service and food
   double crispInputService = 40;
   double crispInputFood = 60;
@@ -641,15 +6369,14 @@ int main()
   // Fuzzification of crisp input values for each input fuzzy set
   for (auto &inputSet : inputSets)
   {
-    // Fuzzify the service crisp value if the set name contains "Service"
-    if ((inputSet.getName().find("Service") != string::npos) ||
-        inputSet.getName().find("waiting_time") != string::npos)
+    int input = inputIndexOf(inputSet);
+    // Fuzzify the service crisp value for the service or waiting time sets
+    if (input == 0)
     {
       inputSet.fuzzify(crispInputService);
     }
-    // Fuzzify the food crisp value if the set name contains "Food"
-    else if ((inputSet.getName().find("Food") != string::npos) ||
-             (inputSet.getName().find("price") != string::npos))
+    // Fuzzify the food crisp value for the food or price sets
+    else if (input == 1)
     {
       inputSet.fuzzify(crispInputFood);
     }
@@ -673,11 +6400,26 @@ int main()
   std::string filename2 = "rules.txt";
   readRulesFromFile(filename2, rulesTipping);
 
+  // Order the antecedents with the selectivity profile recorded from
+  // production traffic, if one was saved with the model
+  SelectivityProfile profileTipping;
+  if (profileTipping.load("selectivity.txt"))
+    rulesTipping.orderBySelectivity(profileTipping);
+
   // Print the loaded rules
   rulesTipping.printRules();
   cout << "\nRules added for tipping based on service and food quality\n"
        << endl;
 
+  // Compile the antecedents into a DAG that evaluates shared clauses once
+  RuleDag dagTipping;
+  rulesTipping.compileDag(dagTipping);
+  cout << "Antecedent DAG: " << dagTipping.nodeCount() << " nodes, "
+       << dagTipping.sharedOps() << " operations per inference instead of "
+       << dagTipping.unsharedOpCount() << " ("
+       << dagTipping.unsharedOpCount() - dagTipping.sharedOps()
+       << " saved by sharing)" << endl;
+
   // Infer the output values using the rules and input fuzzy membership values
   // Store the inferred output values in a map
   map<string, double> outputValuesTipping = rulesTipping.inferMamdani(inputMembershipValues);
@@ -689,6 +6431,142 @@ int main()
     cout << output.first << ": " << output.second << endl;
   }
 
+  // Defuzzify the output values with the centroid method
+  double crispTip = defuzzifyCentroid(outputSets, outputValuesTipping);
+  cout << "\nCrisp tip (centroid): " << crispTip << endl;
+
+  // Other defuzzifications of the same output, from one sweep
+  Defuzzifier defuzzifierTip(outputSets);
+  DefuzzifiedOutputs tips = defuzzifierTip.defuzzify(outputValuesTipping);
+  AdaptiveCentroid adaptiveTip = defuzzifyAdaptive(outputSets, outputValuesTipping, 1e-6);
+  cout << "Adaptive centroid: " << adaptiveTip.crisp << " (+/- "
+       << adaptiveTip.errorEstimate << ", " << adaptiveTip.samples << " samples)" << endl;
+  cout << "Bisector: " << tips.bisector << ", MOM: " << tips.meanOfMaximum
+       << ", SOM: " << tips.smallestOfMaximum << ", LOM: "
+       << tips.largestOfMaximum << endl;
+
+  // Approximate inference that drops the rules weaker than 0.5
+  ApproximateResult approxTip =
+      inferApproximate(rulesTipping, inputMembershipValues, outputSets, 0.5);
+  cout << "Approximate tip (epsilon 0.5): " << approxTip.crisp << " +/- "
+       << approxTip.errorBound << " using " << approxTip.keptRules
+       << " rules (" << approxTip.prunedRules << " pruned)" << endl;
+
+  // Incremental inference: only the rules using the waiting time are
+  // re-evaluated when the service input changes
+  IncrementalInference incrementalTip(inputSets, rulesTipping);
+  incrementalTip.setInputs({crispInputService, crispInputFood});
+  incrementalTip.setInput(0, crispInputService + 20);
+  cout << "Tip with service " << crispInputService + 20 << " (incremental, "
+       << incrementalTip.getLastEvaluations() << " rules re-evaluated): "
+       << defuzzifyCentroid(outputSets, incrementalTip.getOutputValues()) << endl;
+
+  // Memoize the crisp pipeline on inputs quantized to whole units
+  InferenceCache cacheTip(1 << 20, 1.0);
+  auto computeTip = [&](const vector<double> &inputs)
+  { return vector<double>{inferCrisp(inputSets, rulesTipping, outputSets, inputs)}; };
+  for (double service : {40.0, 40.2, 60.0, 39.9, 60.4})
+    cacheTip.get({service, crispInputFood}, computeTip);
+  cout << "Inference cache: " << cacheTip.getHits() << " hits, "
+       << cacheTip.getMisses() << " misses, " << cacheTip.getEvictions()
+       << " evictions, " << cacheTip.bytesUsed() << " bytes" << endl;
+
+  // Batch inference over rows that repeat a few input combinations
+  BatchEngine batchTip(inputSets, rulesTipping, outputSets);
+  vector<double> batchRows;
+  for (int r = 0; r < 1000; r++)
+  {
+    batchRows.push_back(10.0 * (r % 5));
+    batchRows.push_back(crispInputFood);
+  }
+  vector<double> batchTips = batchTip.infer(batchRows);
+  cout << "Batch of " << batchTips.size() << " rows: "
+       << batchTip.getLastInferences() << " inferences, first tip "
+       << batchTips[0] << endl;
+
+  // Fuzzification with uint16 membership tables over integer inputs
+  FlatRuleBase tableModel;
+  tableModel.compile(inputSets, rulesTipping, outputSets, 2);
+  vector<LinguisticVariable> inputVariables;
+  for (const auto &variable : readLinguisticVariables(filename))
+    if (!variable.output)
+      inputVariables.push_back(variable);
+  TableFuzzifier<uint16_t> tableFuzzifier(tableModel, inputVariables, {1, 1});
+  vector<double> tableDegrees(tableModel.termNames.size());
+  vector<double> tableActivation(tableModel.outputNames.size());
+  double tableInputs[] = {crispInputService, crispInputFood};
+  tableFuzzifier.fuzzify(tableInputs, tableDegrees.data());
+  tableModel.infer(tableDegrees.data(), tableActivation.data());
+  cout << "Tip with membership tables (" << tableFuzzifier.bytes() << " bytes): "
+       << Defuzzifier(outputSets).defuzzify(tableActivation.data()).centroid << endl;
+
+  // Integer-only engine for targets without a fast FPU
+  FixedPointEngine fixedTip(inputSets, rulesTipping, outputSets);
+  cout << "Tip (fixed point): " << fixedTip.infer({crispInputService, crispInputFood}) << endl;
+
+  // Single precision with twice the SIMD lanes
+  ScalarEngine<float> floatTip(inputSets, rulesTipping, outputSets);
+  cout << "Tip (float): " << floatTip.infer({crispInputService, crispInputFood}) << endl;
+
+  // Engine with the operators selected in the model file
+  InferencePolicy policyTip;
+  readInferencePolicy(filename, policyTip);
+  unique_ptr<InferenceEngine> policyEngine =
+      makeInferenceEngine(policyTip, inputSets, rulesTipping, outputSets);
+  cout << "Tip with the model operators: "
+       << policyEngine->infer({crispInputService, crispInputFood}) << endl;
+
+  // Takagi-Sugeno-Kang version of the model, with crisp consequents
+  Rules rulesTsk;
+  readRulesFromFile("rules_tsk.txt", rulesTsk);
+  TskEngine tskTip(inputSets, rulesTsk);
+  if (tskTip.isValid() && tskTip.size() > 0)
+    cout << "Tip (TSK): " << tskTip.infer({crispInputService, crispInputFood}) << endl;
+
+  // Only the dominant tip label, without defuzzification
+  LazyInference lazyTip(inputSets, rulesTipping, outputSets);
+  double crispInputs[] = {crispInputService, crispInputFood};
+  int label = lazyTip.inferLabel(crispInputs);
+  cout << "Dominant tip label: "
+       << (label >= 0 ? lazyTip.getOutputNames()[label] : "none") << endl;
+
+  // Activation of Tip_High alone: only its rules and their terms are used
+  const vector<string> &tipLabels = lazyTip.getOutputNames();
+  size_t highIndex = find(tipLabels.begin(), tipLabels.end(), "Tip_High") - tipLabels.begin();
+  if (highIndex < tipLabels.size())
+  {
+    vector<bool> requested(tipLabels.size(), false);
+    requested[highIndex] = true;
+    vector<double> requestedDegrees(tipLabels.size());
+    lazyTip.infer(crispInputs, requested, requestedDegrees.data());
+    cout << "Tip_High alone: " << requestedDegrees[highIndex] << " ("
+         << lazyTip.getLastEvaluations() << " rules, "
+         << lazyTip.getLastFuzzifications() << " terms fuzzified)" << endl;
+  }
+
+  // Tip and satisfaction from a single fuzzification and antecedent pass
+  vector<InputFuzzySet> multiInputSets;
+  vector<OutputFuzzySet> multiOutputSets;
+  readFuzzySetsFromFile("variables_multi.txt", multiInputSets, multiOutputSets);
+  Rules rulesMulti;
+  readRulesFromFile("rules_multi.txt", rulesMulti);
+  MultiOutputEngine multiEngine(
+      multiInputSets, rulesMulti,
+      groupOutputSets(multiOutputSets, readOutputVariableNames("variables_multi.txt")));
+  vector<double> multiCrisp(multiEngine.variableCount());
+  multiEngine.infer(crispInputs, multiCrisp.data());
+  for (size_t v = 0; v < multiEngine.variableCount(); v++)
+    cout << multiEngine.variableName(v) << " (multi-output): " << multiCrisp[v] << endl;
+
+  // Quality from service and food, then tip from quality and ambience
+  HierarchicalSystem hierarchy;
+  if (readHierarchyFromFile("hierarchy/model.txt", hierarchy))
+  {
+    vector<double> hierarchyOutputs = hierarchy.infer({4, 6, 7});
+    for (size_t o = 0; o < hierarchy.outputCount(); o++)
+      cout << hierarchy.outputName(o) << " (hierarchical): " << hierarchyOutputs[o] << endl;
+  }
+
   cout << "\nFuzzy logic system processed all inputs successfully." << endl;
 
   return 0;